@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+
+/*
+ * Each thread keeps an open addressing hash set of 2^DEDUP_SET_BITS entries.
+ * A lookup probes at most DEDUP_MAX_PROBES entries.
+ */
+#define DEDUP_SET_BITS 9
+#define DEDUP_SET_SIZE (1 << DEDUP_SET_BITS)
+#define DEDUP_MAX_PROBES 8
+
+namespace romp {
+
+/*
+ * An entry of the dedup set records which bytes of a shadow granule have been
+ * read and written in the current interval. An entry whose stamp differs from
+ * the stamp of the set is empty.
+ */
+typedef struct DedupEntry {
+  uint64_t granule;
+  uint32_t stamp;
+  uint8_t readMask;
+  uint8_t writeMask;
+} DedupEntry;
+
+bool accessIsDuplicate(uint64_t granule,
+                       uint8_t byteMask,
+                       bool isWrite,
+                       uint32_t labelId,
+                       uint32_t lockSetId,
+                       bool inReduction);
+void clearThreadDedupSet();
+void getAccessDedupStats(uint64_t& hits, uint64_t& misses);
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+
+#include "DataSharing.h"
+
+namespace romp {
+
+/*
+ * Filters applied to a memory access before its shadow memory is looked up.
+ * An access rejected by any filter can not be involved in a data race, so it
+ * neither touches nor populates shadow memory.
+ */
+enum AccessFilterType {
+  eFilterHwLock, // access protected by hardware lock
+  eFilterThreadPrivateBelowExit, // task private stack frame
+  eFilterStaticThreadPrivate, // static thread local storage
+  eNumAccessFilters,
+};
+
+bool filterAccess(bool hwLock, DataSharingType dataSharingType);
+void getAccessFilterStats(uint64_t& numChecked,
+                          uint64_t numFiltered[eNumAccessFilters]);
+const char* getAccessFilterName(int filter);
+
+}
@@ -1,10 +1,8 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
-#include <memory>
-#include <vector>
 
-#include "McsLock.h"
-#include "Record.h"
+#include "RecordStorage.h"
 
 namespace romp {
 
@@ -13,25 +11,82 @@ enum AccessHistoryFlag {
   eMemoryRecycled = 0x2,
 };
 
+/*
+ * The sync word of an access history packs the spin bit, the flags, the data
+ * race mask and the version of the seqlock:
+ * bit 0 is set while a writer holds the history,
+ * bits [1, 2] hold the access history flags,
+ * bits [3, 10] record which bytes of the shadow granule have been involved 
+ * in a reported data race,
+ * bits [11, 31] count the modifications of the history.
+ */
+#define SYNC_LOCK_BIT 0x1
+#define FLAG_SHIFT 1
+#define DATA_RACE_MASK_SHIFT 3
+#define VERSION_SHIFT 11
+
+/*
+ * A writer spins this many times on a held access history before yielding
+ * the processor.
+ */
+#define HISTORY_SPIN_LIMIT 64
+
+/*
+ * An access history is the shadow memory cell of an aligned granule. With 
+ * one inline record it is 32 bytes, so two cells share a cache line and no 
+ * cell straddles two lines.
+ */
 class AccessHistory {
 
 public: 
-  AccessHistory() : _state(0) { mcsInit(&_lock); }
-  McsLock& getLock();
-  std::vector<Record>* getRecords();
+  AccessHistory() : _sync(0), _owner(0), _generation(0) {}
+  RecordStorage* getRecords();
+  const RecordStorage* getRecords() const;
   void setFlag(AccessHistoryFlag flag);
   void clearFlags();
   void clearFlag(AccessHistoryFlag flag);
   bool dataRaceFound() const;
   bool memIsRecycled() const;
-  uint64_t getState() const;
+  void setDataRaceMask(uint8_t byteMask);
+  uint8_t getDataRaceMask() const;
+  void setGeneration(uint32_t generation);
+  uint32_t getGeneration() const;
+  void lock();
+  void unlock();
+  uint32_t beginOptimisticRead() const;
+  bool validateOptimisticRead(uint32_t version) const;
+  uint32_t getOwner() const;
+  void setOwner(uint32_t ownerId);
 private:
-  void _initRecords();
+  void _setSyncBits(uint32_t bits);
+  void _clearSyncBits(uint32_t bits);
 private:
-  McsLock _lock; 
-  uint64_t _state;  
-  std::unique_ptr<std::vector<Record>> _records; 
+  std::atomic<uint32_t> _sync; // spin bit, flags, data race mask and version
+  uint32_t _owner; // ownership epoch of all records, 0 if shared
+  uint32_t _generation; // shadow memory generation last validated against
+  RecordStorage _records; 
+};
 
+#if NUM_INLINE_RECORDS == 1
+static_assert(sizeof(AccessHistory) == 32, "access history should be 32 bytes");
+#endif
+
+/*
+ * Lock guard for modifying the access history. Holding the spin bit makes 
+ * optimistic readers fail, and the version is advanced on release, so that 
+ * they also detect a modification that has completed.
+ */
+class HistoryWriteGuard {
+public:
+  HistoryWriteGuard(AccessHistory* accessHistory): 
+      _accessHistory(accessHistory) {
+    _accessHistory->lock();
+  }
+  ~HistoryWriteGuard() {
+    _accessHistory->unlock();
+  }
+private:
+  AccessHistory* _accessHistory;
 };
 
 }
@@ -12,6 +12,14 @@ namespace romp {
  */
 #define CASE_SHIFT 2
 
+/*
+ * Concurrent reads of at least this many implicit tasks of one team within a
+ * barrier epoch are folded into a single read summary record.
+ */
+#ifndef READ_SUMMARY_THRESHOLD
+#define READ_SUMMARY_THRESHOLD 4
+#endif
+
 enum CheckCase {
   eImpImp = eImplicit | (eImplicit << CASE_SHIFT),
   eImpExp = eImplicit | (eExplicit << CASE_SHIFT),
@@ -47,6 +55,8 @@ bool analyzeSyncChain(Label* label, int index);
 bool analyzeMutualExclusion(const Record& histRecord, const Record& curRecord);
 bool analyzeRaceCondition(const Record& histRecord, const Record& curRecord, 
                           bool& isHistBeforeCur, int& diffIndex);
+bool analyzeReadSummary(const Record& summary, const Record& curRecord, 
+                        bool& isSummaryBeforeCur, int& diffIndex);
 bool analyzeTaskGroupSync(Label* histLabel, Label* curLabel, int index);
 
 bool dispatchAnalysis(CheckCase checkCase, Label* hist, Label* cur, int index);
@@ -60,7 +70,12 @@ RecordManagement manageAccessRecord(const Record& histRecord,
                                     int diffIndex);
 
 void modifyAccessHistory(RecordManagement decision,
-                         std::vector<Record>* records,
-                         std::vector<Record>::iterator& cit);
+                         RecordStorage* records,
+                         Record*& it,
+                         uint8_t curByteMask);
+
+void clearRecordBytes(RecordStorage* records, uint8_t byteMask);
+
+void summarizeReads(RecordStorage* records, Record& curRecord);
 
 }
@@ -48,11 +48,16 @@ typedef struct CheckInfo {
   AllTaskInfo allTaskInfo;
   uint32_t bytesAccessed;
   void* instnAddr;
+  uint32_t siteId; // id of instnAddr in the site intern table
+  uint32_t ownerId; // ownership epoch of the accessing task
   void* taskPtr;
   int taskType;
   bool isWrite;
   bool hwLock; 
-  uint64_t byteAddress;
+  uint64_t byteAddress; // base address of the shadow granule being checked
+  uint8_t byteMask; // bytes of the granule touched by the access
+  uint32_t generation; // shadow memory generation of the granule
+  uint32_t pruneGeneration; // generation of the last history pruning
   DataSharingType dataSharingType;
 } CheckInfo; 
 
@@ -70,4 +75,6 @@ void reportDataRace(void* instnAddrPrev, void* instnAddrCur, uint64_t address);
 
 void* computeAddressRangeEnd(void* baseAddr, size_t chunkSize);
 
+uint8_t computeByteMask(uint64_t offset, uint64_t numBytes);
+
 }
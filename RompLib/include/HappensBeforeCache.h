@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+
+#include "Label.h"
+
+/*
+ * Each thread keeps a direct mapped cache of 2^HB_CACHE_BITS entries.
+ */
+#define HB_CACHE_BITS 10
+#define HB_CACHE_SIZE (1 << HB_CACHE_BITS)
+
+namespace romp {
+
+/*
+ * Cached result of happensBefore() for a pair of history label and current
+ * label. Labels are hash-consed, and a released label may be reallocated at
+ * the same address, so the labels are identified by their serial numbers.
+ * Serial 0 marks an empty entry.
+ */
+typedef struct HbCacheEntry {
+  uint64_t histSerial;
+  uint64_t curSerial;
+  uint32_t syncEpoch; // sync epoch when the result was computed
+  int32_t diffIndex;
+  bool isHistBeforeCur;
+} HbCacheEntry;
+
+bool happensBeforeCached(Label* histLabel, Label* curLabel, int& diffIndex);
+void advanceSyncEpoch();
+void getHappensBeforeCacheStats(uint64_t& hits, uint64_t& misses);
+
+}
@@ -6,10 +6,14 @@
 #include <string>
 #include <Symtab.h>
 
+#include "AccessDedup.h"
+#include "AccessFilter.h"
 #include "Callbacks.h"
 #include "CoreUtil.h"
+#include "HappensBeforeCache.h"
 #include "McsLock.h"
 #include "QueryFuncs.h"
+#include "ShadowMemory.h"
 
 /* 
  * This header file defines functions that are used 
@@ -21,6 +25,7 @@ bool gOmptInitialized = false;
 bool gDataRaceFound = false;
 bool gReportLineInfo = false;
 bool gReportAtRuntime = false;
+uint32_t gShadowIdleEpochs = SHADOW_IDLE_EPOCHS;
 Dyninst::SymtabAPI::Symtab* gSymtabHandle = nullptr;
 
 McsLock gDataRaceLock;
@@ -61,6 +66,15 @@ int omptInitialize(ompt_function_lookup_t lookup,
   if (flag != nullptr && std::string(flag) == "on") {
     gReportAtRuntime = true;
   }
+  flag = getenv("ROMP_SHADOW_IDLE_EPOCHS");
+  if (flag != nullptr) {
+    // 0 keeps idle shadow pages
+    gShadowIdleEpochs = static_cast<uint32_t>(strtoul(flag, nullptr, 10));
+  }
+  flag = getenv("ROMP_MCS_PARKING");
+  if (flag != nullptr) {
+    mcsSetParking(std::string(flag) == "on");
+  }
   auto ompt_set_callback = 
       (ompt_set_callback_t)lookup("ompt_set_callback");
 
@@ -103,6 +117,27 @@ void omptFinalize(ompt_data_t* toolData) {
   } else {
     LOG(INFO) << "no data race found";
   }
+  uint64_t hbCacheHits, hbCacheMisses;
+  getHappensBeforeCacheStats(hbCacheHits, hbCacheMisses);
+  auto hbQueries = hbCacheHits + hbCacheMisses;
+  if (hbQueries > 0) {
+    LOG(INFO) << "happens-before cache hits: " << hbCacheHits << "/" << 
+        hbQueries << " (" << (100.0 * hbCacheHits / hbQueries) << "%)";
+  }
+  uint64_t dedupHits, dedupMisses;
+  getAccessDedupStats(dedupHits, dedupMisses);
+  auto dedupLookups = dedupHits + dedupMisses;
+  if (dedupLookups > 0) {
+    LOG(INFO) << "access dedup hits: " << dedupHits << "/" << dedupLookups <<
+        " (" << (100.0 * dedupHits / dedupLookups) << "%)";
+  }
+  uint64_t numChecked, numFiltered[eNumAccessFilters];
+  getAccessFilterStats(numChecked, numFiltered);
+  LOG(INFO) << "accesses checked: " << numChecked;
+  for (int i = 0; i < eNumAccessFilters; ++i) {
+    LOG(INFO) << "accesses filtered by " << getAccessFilterName(i) << ": " <<
+        numFiltered[i];
+  }
 }
 
 }
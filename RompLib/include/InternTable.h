@@ -0,0 +1,155 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <glog/logging.h>
+#include <glog/raw_logging.h>
+#include <memory>
+
+/*
+ * An intern table maps a 32-bit id to an entry. Entries are stored in chunks
+ * of 2^INTERN_CHUNK_BITS entries, chunk pointers are stored in a directory
+ * of 2^(32 - INTERN_CHUNK_BITS) entries.
+ */
+#define INTERN_CHUNK_BITS 16
+#define INTERN_CHUNK_SIZE (1UL << INTERN_CHUNK_BITS)
+#define INTERN_DIR_SIZE (1UL << (32 - INTERN_CHUNK_BITS))
+
+/*
+ * Id 0 is reserved for the null entry.
+ */
+#define NULL_INTERN_ID 0
+
+namespace romp {
+
+class Label;
+class LockSet;
+struct TaskData;
+
+/*
+ * InternTable is a table of entries indexed by 32-bit id. The table itself
+ * never removes an entry, a user that releases entries hands their ids out 
+ * again with `reuse`. A looked-up entry stays valid as long as the caller holds on
+ * to its id. An id is only handed out after its entry is written, lookups of
+ * published ids do not need synchronization.
+ */
+template<typename T>
+class InternTable {
+
+public:
+  InternTable(): _nextId(NULL_INTERN_ID + 1) {}
+  uint32_t add(const T& entry);
+  void reuse(uint32_t id, const T& entry);
+  const T& get(uint32_t id) const;
+  T& get(uint32_t id);
+  uint32_t size() const;
+private:
+  T* _getChunk(uint32_t chunkIndex);
+private:
+  std::atomic<uint32_t> _nextId;
+  std::atomic<T*> _chunks[INTERN_DIR_SIZE];
+};
+
+/*
+ * Store `entry` in the table and return its id.
+ */
+template<typename T>
+uint32_t InternTable<T>::add(const T& entry) {
+  auto id = _nextId.fetch_add(1, std::memory_order_relaxed);
+  if (id == NULL_INTERN_ID) {
+    RAW_LOG(FATAL, "intern table id space is exhausted");
+  }
+  auto chunk = _getChunk(id >> INTERN_CHUNK_BITS);
+  chunk[id & (INTERN_CHUNK_SIZE - 1)] = entry;
+  return id;
+}
+
+/*
+ * Store `entry` under `id`, which was handed out by `add` before and whose
+ * entry is no longer referred to by anyone.
+ */
+template<typename T>
+void InternTable<T>::reuse(uint32_t id, const T& entry) {
+  get(id) = entry;
+}
+
+template<typename T>
+const T& InternTable<T>::get(uint32_t id) const {
+  auto chunk = _chunks[id >> INTERN_CHUNK_BITS].load(std::memory_order_relaxed);
+  return chunk[id & (INTERN_CHUNK_SIZE - 1)];
+}
+
+template<typename T>
+T& InternTable<T>::get(uint32_t id) {
+  auto chunk = _chunks[id >> INTERN_CHUNK_BITS].load(std::memory_order_relaxed);
+  return chunk[id & (INTERN_CHUNK_SIZE - 1)];
+}
+
+/*
+ * Return the number of ids handed out by `add`.
+ */
+template<typename T>
+uint32_t InternTable<T>::size() const {
+  return _nextId.load(std::memory_order_relaxed) - 1;
+}
+
+/*
+ * Get the chunk at `chunkIndex`, allocate it if it does not exist yet.
+ * Threads racing on the allocation agree on one chunk through cas.
+ */
+template<typename T>
+T* InternTable<T>::_getChunk(uint32_t chunkIndex) {
+  auto chunk = _chunks[chunkIndex].load(std::memory_order_acquire);
+  if (chunk) {
+    return chunk;
+  }
+  auto newChunk = new T[INTERN_CHUNK_SIZE]();
+  if (_chunks[chunkIndex].compare_exchange_strong(chunk, newChunk,
+              std::memory_order_acq_rel)) {
+    return newChunk;
+  }
+  delete[] newChunk;
+  return chunk;
+}
+
+/*
+ * Entry of the label intern table. Labels are hash-consed and may be shared,
+ * so an entry records a pair of label and the task running with the label.
+ * The entry also records the team of the task and its barrier epoch when
+ * running with the label. The entry keeps the label alive as long as it is
+ * referred to: by the task until it runs with another label or is freed, by
+ * every access record carrying the id, and by dedup sets keyed on the id.
+ * The last reference releases the entry and its id is reused.
+ * The task data is freed once the task completes, so `taskPtr` may only be
+ * followed for the current task. Information about the task needed to 
+ * analyze history records is copied into the entry.
+ */
+typedef struct LabelEntry {
+  std::shared_ptr<Label> label;
+  void* taskPtr;
+  uint32_t teamId;
+  uint32_t barrierEpoch;
+  bool isExplicitTask;
+  int expLocalId; // local id of the explicit task in its parallel region
+  uint32_t refCount; // updated atomically, see retainLabelEntry
+} LabelEntry;
+
+uint32_t internTaskLabel(TaskData* taskData);
+void retainLabelEntry(uint32_t id);
+void releaseLabelEntry(uint32_t id);
+uint32_t internLockSet(const LockSet* lockSet);
+const LockSet* getLockSetAfterAcquire(const LockSet* lockSet, uint64_t lock);
+const LockSet* getLockSetAfterRelease(const LockSet* lockSet, uint64_t lock);
+uint32_t internSite(void* instnAddr);
+uint32_t getTaskOwnerId(TaskData* taskData);
+void resetTaskOwnerId(TaskData* taskData);
+
+Label* getInternedLabel(uint32_t id);
+void* getInternedTask(uint32_t id);
+const LabelEntry& getInternedLabelEntry(uint32_t id);
+bool isOrderedByBarrier(uint32_t histLabelId, uint32_t curLabelId);
+bool isInSameBarrierEpoch(uint32_t leftLabelId, uint32_t rightLabelId);
+const LockSet* getInternedLockSet(uint32_t id);
+void* getInternedSite(uint32_t id);
+
+}
@@ -8,35 +8,55 @@ namespace romp {
 enum LabelCompare {
   eSameLabel = -3,
   eLeftIsPrefix = -1,
-  eRightIsPrefix = -2, 
+  eRightIsPrefix = -2,
 };
 /*
  * Label class implements the high level representation of task label.
- * A task label consists of a series of label segments. Each label segment is 
- * represented by a derived class from Segment. 
+ * A task label consists of a series of label segments. Each label segment is
+ * a plain Segment value stored in the label node.
+ * Labels are persistent: a label node holds its last segment and points to
+ * the label of its prefix, so that a mutation creates at most a couple of
+ * new nodes and shares the prefix with the original label. Label nodes are
+ * hash-consed through makeLabel(), labels with the same segments have the
+ * same node. Each node also keeps a jump pointer to an ancestor, which
+ * locates the k-th segment in O(log(length)) steps.
+ * A node gets a serial number that is never reused, it identifies the label
+ * in caches that outlive the node.
  */
-class Label {
+class Label : public std::enable_shared_from_this<Label> {
 
 public:
-  Label() {}
-  Label(const Label& label);
-  ~Label() {} 
+  Label(const std::shared_ptr<Label>& parent,
+        const Segment& segment,
+        uint64_t hash);
+  ~Label() {}
   std::string toString() const;
-  void appendSegment(const std::shared_ptr<Segment>& segment);
-  std::shared_ptr<Segment> popSegment();
-  std::shared_ptr<Segment> getLastKthSegment(int k);
-  void setLastKthSegment(int k, const std::shared_ptr<Segment>& segment);
-  Segment* getKthSegment(int k);
+  const std::shared_ptr<Label>& getParent() const;
+  const Segment& getSegment() const;
+  Segment* getLastKthSegment(int k) const;
+  Segment* getKthSegment(int k) const;
   friend int compareLabels(Label* left, Label* right);
   int getLabelLength() const;
+  uint64_t getHash() const;
+  uint64_t getSerial() const;
 private:
-  std::vector<std::shared_ptr<Segment> > _label;
+  const Label* _getKthNode(int k) const;
+private:
+  std::shared_ptr<Label> _parent; // label without the last segment
+  const Label* _jump; // ancestor for level ancestor search
+  mutable Segment _segment; // last segment, sync marks are set in place
+  int _length;
+  uint64_t _hash;
+  uint64_t _serial;
 };
 
 int compareLabels(Label* left, Label* right);
 
+std::shared_ptr<Label> makeLabel(const std::shared_ptr<Label>& parent,
+                                 const Segment& segment);
+
 std::shared_ptr<Label> genImpTaskLabel(
-                          Label* parentLabel, 
+                          Label* parentLabel,
                           unsigned int index,
                           unsigned int actualParallelism);
 
@@ -1,41 +1,43 @@
 #pragma once
-#include <memory>
+#include <cstdint>
 #include <string>
+#include <vector>
 
-namespace romp {
+/*
+ * Number of entries in the per-thread direct mapped cache of lockset
+ * transitions upon lock acquire and release.
+ */
+#define LOCKSET_CACHE_SIZE 64
 
-class LockSet {
-public:
-  virtual std::string toString() const = 0;
-  virtual bool hasCommonLock(const LockSet& other) const = 0;
-  virtual std::shared_ptr<LockSet> clone() const = 0;
-  virtual void addLock(uint64_t lock) = 0;
-  virtual void removeLock(uint64_t lock) = 0;
-  virtual void* getLocks() = 0;
-  virtual uint16_t getNumLocks() const = 0; 
-  virtual ~LockSet() = default;
-};
+namespace romp {
 
 /*
- * SmallLockSet class is for recording the set of locks held upon
- * a memory access. This class holds at most four nested locks
+ * LockSet class records the set of locks held upon a memory access. Locks
+ * are kept sorted, a lock acquired more than once in a nest appears more
+ * than once. Locksets are interned and immutable: the task moves to another
+ * interned lockset upon acquire and release, so two locksets with the same
+ * locks are the same object and share one intern id. The empty lockset is
+ * represented by nullptr.
+ * The signature has one bit set per lock in the set. Two locksets without
+ * common signature bits have no common lock.
  */
-class SmallLockSet : public LockSet {
+class LockSet {
 public:
-  SmallLockSet();
-  SmallLockSet(const SmallLockSet& lockset);
-  std::string toString() const override;
-  std::shared_ptr<LockSet> clone() const override; 
-  bool hasCommonLock(const LockSet& other) const override;
-  void addLock(uint64_t lock) override;
-  void removeLock(uint64_t lock) override;
-  void* getLocks() override; 
+  LockSet(std::vector<uint64_t> locks);
+  std::string toString() const;
+  bool hasCommonLock(const LockSet& other) const;
+  const std::vector<uint64_t>& getLocks() const;
   uint16_t getNumLocks() const;
+  uint64_t getSignature() const;
+  uint32_t getInternId() const;
+  void setInternId(uint32_t id);
 private:
-  uint64_t _locks[4];
-  uint16_t _numLocks;
+  std::vector<uint64_t> _locks;
+  uint64_t _signature;
+  uint32_t _internId; // id in the lockset intern table
 };
 
-bool isSubset(LockSet* me, LockSet* other);
+uint64_t getLockSignature(uint64_t lock);
+bool isSubset(const LockSet* me, const LockSet* other);
 
 }
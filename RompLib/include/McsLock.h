@@ -76,7 +76,7 @@
 
 typedef struct McsNode {
   std::atomic<struct McsNode*> next;
-  std::atomic_bool blocked;
+  std::atomic<int> blocked; // one of the MCS_* waiter states, a futex word
 } McsNode;
 
 
@@ -92,6 +92,14 @@ typedef struct {
 
 #define MCS_NIL (struct McsNode*) 0
 
+// waiter states stored in McsNode::blocked
+#define MCS_GRANTED 0
+#define MCS_WAITING 1
+#define MCS_PARKED 2
+
+// number of polls of a waiter before it parks itself on the futex
+#define MCS_SPIN_LIMIT 128
+
 //******************************************************************************
 // interface functions
 //******************************************************************************
@@ -114,6 +122,20 @@ mcsTryLock(McsLock *l, McsNode *me);
 void
 mcsUnlock(McsLock *l, McsNode *me);
 
+
+//------------------------------------------------------------------------------
+// waiters spin for MCS_SPIN_LIMIT polls and then park on a futex if parking
+// is enabled, otherwise they spin until the lock is handed over. parking is
+// on by default if built with MCS_FUTEX_PARKING. it may be switched at any 
+// time, the hand over wakes a parked waiter either way.
+//------------------------------------------------------------------------------
+void
+mcsSetParking(bool enabled);
+
+
+bool
+mcsParkingEnabled();
+
 /*
  * A custom implementation of lock guard that wraps mcs locking/unlocking
  */
@@ -6,22 +6,34 @@
 
 namespace romp {
 
+extern std::atomic<uint32_t> gNextTeamId;
+
 typedef struct ParRegionData {
   void* dataPtr;  
   unsigned int numParallelism;
   int parallelFlag;
+  bool isOutermost; // the region is encountered by an initial task
+  uint32_t teamId; // unique id of the team, never reused
   McsLock lock;      
   std::atomic_int expTaskCount; 
-  ParRegionData() { mcsInit(&lock); }
+  ParRegionData() : isOutermost(false), teamId(0), taskDepGraph(nullptr) { 
+    mcsInit(&lock); 
+  }
   ParRegionData(unsigned int n, int p): numParallelism(n), parallelFlag(p) {
     dataPtr = nullptr; 
+    isOutermost = false;
+    teamId = gNextTeamId.fetch_add(1, std::memory_order_relaxed);
     expTaskCount = 0;
+    taskDepGraph = nullptr;
     mcsInit(&lock);
   } 
-  TaskDepGraph taskDepGraph;
+  ~ParRegionData() { delete taskDepGraph.load(std::memory_order_relaxed); }
+  // created upon the first task dependence in the region under `lock`
+  std::atomic<TaskDepGraph*> taskDepGraph;
 } ParRegionData;
 
-void maintainTaskDeps(const ompt_dependence_t& dependence, 
+void maintainTaskDeps(const ompt_dependence_t* deps, 
+		      int ndeps,
 		      void* taskPtr, 
 		      ParRegionData* parRegionData);
 
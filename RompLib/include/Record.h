@@ -1,44 +1,58 @@
 #pragma once
+#include <cstdint>
+#include <string>
+
 #include "Label.h"
 #include "LockSet.h"
 
-
 namespace romp {
 
 /*
  * `Record` class stores a sync info associated with a single memory access.
+ * Label, lock set and instruction address are stored as 32-bit ids into the
+ * global intern tables, so that a record fits in 16 bytes and copying a 
+ * record does not touch any reference count. The task pointer of the access
+ * is recorded with the interned label.
  */
 class Record {
   
 public:
-  Record(): _state(0), _label(nullptr), _lockSet(nullptr), 
-    _taskPtr(nullptr), _instnAddr(0){}
+  Record(): _labelId(0), _lockSetId(0), _siteId(0), _state(0), _byteMask(0),
+    _reserved(0) {}
   Record(bool isWrite, 
-         std::shared_ptr<Label> label, 
-         std::shared_ptr<LockSet> lockSet,   
-         void* taskPtr, 
-         void* instnAddr): 
-      _label(label), _lockSet(lockSet), _taskPtr(taskPtr), 
-      _instnAddr(instnAddr) { 
+         uint32_t labelId, 
+         uint32_t lockSetId,   
+         uint32_t siteId,
+         uint8_t byteMask): 
+      _labelId(labelId), _lockSetId(lockSetId), _siteId(siteId), _state(0),
+      _byteMask(byteMask), _reserved(0) { 
         setAccessType(isWrite); 
       }
   void setAccessType(bool isWrite);
   void setHasHwLock(bool hwLock);
+  void setReadSummary(bool isSummary);
   bool isWrite() const;
   bool hasHwLock() const;
+  bool isReadSummary() const;
+  uint8_t getByteMask() const;
+  void clearBytes(uint8_t byteMask);
   std::string toString() const;
   Label* getLabel() const;
-  LockSet* getLockSet() const;
+  const LockSet* getLockSet() const;
   void* getInstnAddr() const; 
   void* getTaskPtr() const;
+  uint32_t getLabelId() const;
+  uint32_t getLockSetId() const;
 private:
+  uint32_t _labelId; // id of the task label in the label intern table
+  uint32_t _lockSetId; // id of the lock set in the lockset intern table
+  uint32_t _siteId; // id of the instruction address in the site intern table
   uint8_t _state; // store state information
-  std::shared_ptr<Label> _label; // task label associated with the record
-  std::shared_ptr<LockSet> _lockSet; // lock set associated with the record
-  void* _taskPtr; // pointer to data of encountering task
-  void* _instnAddr;
+  uint8_t _byteMask; // bytes of the shadow granule touched by the access
+  uint16_t _reserved;
 };
 
+static_assert(sizeof(Record) == 16, "access record should be 16 bytes");
 
 }
 
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+
+#include "Record.h"
+
+/*
+ * Number of records stored inline in the access history. Records beyond this
+ * number are spilled to a buffer allocated from a per-thread slab, or from
+ * the heap once the buffer outgrows the slab.
+ */
+#ifndef NUM_INLINE_RECORDS
+#define NUM_INLINE_RECORDS 1
+#endif
+
+/*
+ * Spill buffers are allocated in size classes. Size class k holds
+ * NUM_INLINE_RECORDS << (k + 1) records. Buffers of the first 
+ * NUM_SLAB_SIZE_CLASSES classes that fit in a slab chunk are recycled on
+ * per-thread freelists, larger buffers come from the heap.
+ */
+#define NUM_SLAB_SIZE_CLASSES 16
+
+/*
+ * The record count of a storage takes 27 bits and the size class 5 bits of
+ * one word, which bounds a history to 2^27 - 1 records.
+ */
+#define RECORD_SIZE_BITS 27
+#define MAX_NUM_RECORDS ((1U << RECORD_SIZE_BITS) - 1)
+
+namespace romp {
+
+/*
+ * RecordStorage holds access records of a memory location. The first
+ * NUM_INLINE_RECORDS records live inline in the shadow memory slot, so the
+ * common case of one or two records does not allocate. Once the inline
+ * storage overflows, all records move to a spill buffer whose capacity grows
+ * in size classes.
+ * RecordStorage lives in zero-filled shadow memory and its constructor is
+ * never run, so the all-zero state must be a valid empty storage. To keep 
+ * the shadow cell small, the storage is only 4-byte aligned and the spill 
+ * buffer pointer is kept in the bytes of the inline records.
+ * The interface mirrors the part of std::vector used by the checker, with
+ * Record* as iterator. We assume the storage is under mutual exclusion.
+ */
+class RecordStorage {
+
+public:
+  RecordStorage(): _size(0), _sizeClass(0) {}
+  ~RecordStorage();
+  Record* begin();
+  Record* end();
+  bool empty() const;
+  uint32_t size() const;
+  void push_back(const Record& record);
+  Record* erase(Record* it);
+  void clear();
+  void shrink();
+  bool peek(const Record*& data, uint32_t& size) const;
+private:
+  Record* _data();
+  uint32_t _capacity() const;
+  void _relocate(uint32_t sizeClass);
+  void _grow();
+  Record* _getSpill() const;
+  void _setSpill(Record* spill);
+private:
+  uint32_t _size : RECORD_SIZE_BITS;
+  // 0 means records are inline, k + 1 is spill class k
+  uint32_t _sizeClass : 32 - RECORD_SIZE_BITS;
+  alignas(Record) unsigned char _inline[sizeof(Record) * NUM_INLINE_RECORDS];
+};
+
+static_assert(sizeof(Record) * NUM_INLINE_RECORDS >= sizeof(Record*),
+        "inline records should be able to hold the spill buffer pointer");
+
+void* allocSpillBuffer(uint32_t sizeClass);
+void freeSpillBuffer(void* buffer, uint32_t sizeClass);
+
+}
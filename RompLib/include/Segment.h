@@ -1,7 +1,9 @@
 #pragma once
 #include <cstdint>
-#include <memory> 
 #include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace romp {
 
@@ -17,105 +19,44 @@ enum TaskSyncType {
   eTaskGroupEnd,
 };
 /*
- *  The abstract class definition for label segment 
+ * Segment is a plain 192-bit value. _value records most of the information
+ * wrt. openmp synchronization. _workShareId records the workshare id and the
+ * single construct flags of a workshare segment, it is 0 for other segments.
+ * _taskGroup records the taskgroup information. _orderSecVal records ordered 
+ * section phase when taskwait/taskgroup sync happens.
+ * The first 128 bits, _value and _workShareId, are what label comparison
+ * looks at, so that comparing two segments is a single 128-bit compare.
  */
 class Segment {
-public: 
-  virtual std::string toString() const = 0;
-  virtual void setType(SegmentType type) = 0; 
-  virtual SegmentType getType() const = 0;
-  virtual std::shared_ptr<Segment> clone() const = 0;  
-  virtual void setOffsetSpan(uint64_t offset, uint64_t span) = 0;
-  virtual void setTaskwait(uint64_t taskwait) = 0;
-  virtual void setTaskcreate(uint64_t taskcreate) = 0; 
-  virtual void setPhase(uint64_t phase) = 0;
-  virtual void setLoopCount(uint64_t loopCount) = 0;
-  virtual void setTaskGroupId(uint16_t taskGroupId) = 0;
-  virtual void setTaskGroupLevel(uint16_t taskGroupLevel) = 0;
-  virtual void setTaskGroupPhase(uint16_t phase) = 0;
-  virtual void setTaskwaitPhase(uint16_t phase) = 0;
-  virtual void getOffsetSpan(uint64_t& offset, uint64_t& span) const = 0;
-  virtual void setTaskwaited() = 0;
-  virtual void setTaskGroupSync() = 0;
-  virtual uint64_t getTaskwait() const = 0;
-  virtual uint64_t getTaskcreate() const = 0;
-  virtual uint64_t getPhase() const = 0;
-  virtual uint64_t getLoopCount() const = 0;  
-  virtual uint16_t getTaskGroupId() const = 0;
-  virtual uint16_t getTaskGroupLevel() const = 0;
-  virtual uint16_t getTaskGroupPhase() const = 0;
-  virtual uint16_t getTaskwaitPhase() const = 0;
-  virtual bool isTaskwaited() const = 0;
-  virtual bool isTaskGroupSync() const = 0;
-  virtual bool operator==(const Segment& rhs) const = 0;
-  virtual bool operator!=(const Segment& rhs) const = 0;
-  virtual ~Segment() = default;
-};
-
-/*
- * Base segment is for representing implicit task with no 
- * worksharing construct attached to it.
- * _value records most of the information wrt. openmp synchronization
- * _taskGroup records the taskgroup information
- * _orderSecVal records ordered section phase when taskwait/taskgroup
- * sync happens
- */
-class BaseSegment : public Segment {
 public:
-  BaseSegment(): _value(0), _taskGroup(0), _orderSecVal(0) {}
-  BaseSegment(const BaseSegment& segment): _value(segment._value), 
-             _taskGroup(segment._taskGroup), _orderSecVal(segment._orderSecVal) {}
-  BaseSegment(SegmentType type, uint64_t offset, uint64_t span);
-  std::string toString() const override;
-  void setType(SegmentType type) override;
-  SegmentType getType() const override;
-  std::shared_ptr<Segment> clone() const override;
-  void setOffsetSpan(uint64_t offset, uint64_t span) override;
-  void setTaskwait(uint64_t taskwait) override;
-  void setTaskcreate(uint64_t taskcreate) override;
-  void setPhase(uint64_t phase) override;
-  void setLoopCount(uint64_t loopCount) override;
-  void setTaskGroupId(uint16_t taskGroupId) override;
-  void setTaskGroupLevel(uint16_t taskGroupLevel) override;
-  void setTaskGroupPhase(uint16_t phase) override;
-  void setTaskwaitPhase(uint16_t phase) override;
-  void setTaskwaited() override;
-  void setTaskGroupSync() override; 
-  void getOffsetSpan(uint64_t& offset, uint64_t& span) const override;
-  uint64_t getTaskwait() const override;
-  uint64_t getTaskcreate() const override;
-  uint64_t getPhase() const override;
-  uint64_t getLoopCount() const override;
-  uint16_t getTaskGroupId() const override;
-  uint16_t getTaskGroupLevel() const override;
-  uint16_t getTaskGroupPhase() const override;
-  uint16_t getTaskwaitPhase() const override;
-  bool isTaskwaited() const override;
-  bool isTaskGroupSync() const override;
-  bool operator==(const Segment& rhs) const override; 
-  bool operator!=(const Segment& rhs) const override;
-  uint64_t getValue() const;
-protected:
-  uint64_t _value;
-  uint32_t _taskGroup;
-  uint32_t _orderSecVal; 
-};
-
-/*
- * Workshare segment is for representing task with worksharing 
- * construct.
- */
-class WorkShareSegment: public BaseSegment {
-public:
-  WorkShareSegment() : _workShareId(0) { setType(eWorkShare); 
-      setOffsetSpan(0, 1); }
-  WorkShareSegment(uint64_t id, bool isSection): _workShareId(id) { 
-    setType(eWorkShare); 
-    setWorkShareType(isSection);
-    setOffsetSpan(0, 1);
-  } 
-  WorkShareSegment(const WorkShareSegment& segment): BaseSegment(segment), 
-     _workShareId(segment._workShareId) { }                       
+  Segment(): _value(0), _workShareId(0), _taskGroup(0), _orderSecVal(0) {}
+  Segment(SegmentType type, uint64_t offset, uint64_t span);
+  Segment(uint64_t workShareId, bool isSection);
+  std::string toString() const;
+  void setType(SegmentType type);
+  SegmentType getType() const;
+  void setOffsetSpan(uint64_t offset, uint64_t span);
+  void setTaskwait(uint64_t taskwait);
+  void setTaskcreate(uint64_t taskcreate);
+  void setPhase(uint64_t phase);
+  void setLoopCount(uint64_t loopCount);
+  void setTaskGroupId(uint16_t taskGroupId);
+  void setTaskGroupLevel(uint16_t taskGroupLevel);
+  void setTaskGroupPhase(uint16_t phase);
+  void setTaskwaitPhase(uint16_t phase);
+  void setTaskwaited();
+  void setTaskGroupSync(); 
+  void getOffsetSpan(uint64_t& offset, uint64_t& span) const;
+  uint64_t getTaskwait() const;
+  uint64_t getTaskcreate() const;
+  uint64_t getPhase() const;
+  uint64_t getLoopCount() const;
+  uint16_t getTaskGroupId() const;
+  uint16_t getTaskGroupLevel() const;
+  uint16_t getTaskGroupPhase() const;
+  uint16_t getTaskwaitPhase() const;
+  bool isTaskwaited() const;
+  bool isTaskGroupSync() const;
   void setPlaceHolderFlag(bool toggle);
   bool isPlaceHolder() const;
   void setWorkShareType(bool isSection);
@@ -124,13 +65,37 @@ public:
   bool isSingleExecutor() const;
   bool isSingleOther() const;
   uint64_t getWorkShareId() const;
-  std::string toString() const override;
-  std::shared_ptr<Segment> clone() const override;
-  bool operator==(const Segment& rhs) const override;
-  bool operator!=(const Segment& rhs) const override;
-private: 
+  bool operator==(const Segment& rhs) const; 
+  bool operator!=(const Segment& rhs) const;
+  uint64_t getKeyHash() const;
+  bool hasSameKey(const Segment& rhs) const;
+  uint64_t getValue() const;
+  uint64_t getKeyValue() const;
+private:
+  uint64_t _value;
   uint64_t _workShareId; 
+  uint32_t _taskGroup;
+  uint32_t _orderSecVal; 
 };
 
+static_assert(sizeof(Segment) == 24, "label segment should be 192 bits");
+
+/*
+ * Compare the first 128 bits of two segments. Use one SSE2 compare when it
+ * is available.
+ */
+inline bool Segment::operator==(const Segment& rhs) const {
+#ifdef __SSE2__
+  auto lhsWord = _mm_loadu_si128(reinterpret_cast<const __m128i*>(this));
+  auto rhsWord = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&rhs));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(lhsWord, rhsWord)) == 0xffff;
+#else
+  return _value == rhs._value && _workShareId == rhs._workShareId;
+#endif
+}
+
+inline bool Segment::operator!=(const Segment& rhs) const {
+  return !(*this == rhs);
+}
 
 }
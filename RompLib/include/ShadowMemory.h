@@ -1,7 +1,14 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <glog/logging.h>
 #include <glog/raw_logging.h>
+#include <sys/mman.h>
+#include <vector>
+
+#include "McsLock.h"
 
 /*
  * This header file declares ShadowMemory class template for managing shadow 
@@ -11,6 +18,43 @@
  * on 64 bits system. So we use uint64_t to represent void*
  */
 #define CANONICAL_FORM_MASK 0x0000ffffffffffff
+
+/*
+ * Application address ranges that are mapped directly by FlatShadowMemory. 
+ * The low range holds non-PIE executables and their heap, the middle range 
+ * holds PIE executables and their heap, the high range holds shared 
+ * libraries, mmap'd memory and thread stacks on x86-64 linux.
+ */
+#define FLAT_LOW_APP_BEGIN  0x000000000000
+#define FLAT_LOW_APP_END    0x010000000000
+#define FLAT_MID_APP_BEGIN  0x550000000000
+#define FLAT_MID_APP_END    0x568000000000
+#define FLAT_HIGH_APP_BEGIN 0x7e8000000000
+#define FLAT_HIGH_APP_END   0x800000000000
+// preferred location of the flat shadow region, between low and mid range
+#define FLAT_SHADOW_BASE    0x100000000000
+
+/*
+ * Each shadow page is divided into generation blocks of 2^GEN_BLOCK_BITS 
+ * slots. A page and each of its blocks carries a generation number that is 
+ * bumped when the memory range it covers is invalidated.
+ */
+#define GEN_BLOCK_BITS 6
+
+/*
+ * Generation numbers are 32-bit and must not wrap around, as slots compare
+ * them with `<`. Once the generation counter reaches GEN_RESET_THRESHOLD, 
+ * the next pruneHistory resets all generation numbers to 0. An invalidation
+ * that finds the counter at GEN_MAX before that marks slots one by one.
+ */
+#define GEN_RESET_THRESHOLD (1U << 31)
+#define GEN_MAX (UINT32_MAX - 1)
+
+/*
+ * Default number of region epochs a shadow page may stay untouched before it
+ * is returned to the system by pruneHistory.
+ */
+#define SHADOW_IDLE_EPOCHS 16
 namespace romp {
 
 enum Granularity {
@@ -19,6 +63,29 @@ enum Granularity {
   eLongWordLevel, // aligned eight bytes treated as the same memory access
 };
 
+/*
+ * Return the mask of all bytes of a granule, the granule is at most eight 
+ * bytes large.
+ */
+inline uint8_t getGranuleByteMask(const uint64_t granuleSize) {
+  return static_cast<uint8_t>((1u << granuleSize) - 1);
+}
+
+/*
+ * Return the mask of the bytes of the granule starting at `granuleBase` that
+ * lie in memory range [lowerBound, upperBound]. The granule overlaps with the
+ * range.
+ */
+inline uint8_t getRangeByteMask(const uint64_t granuleBase, 
+                                const uint64_t granuleSize,
+                                const uint64_t lowerBound,
+                                const uint64_t upperBound) {
+  auto first = std::max(granuleBase, lowerBound);
+  auto last = std::min(granuleBase + granuleSize - 1, upperBound);
+  auto numBytes = last - first + 1;
+  return static_cast<uint8_t>(((1u << numBytes) - 1) << (first - granuleBase));
+}
+
 template<typename T>
 class ShadowMemory {
 
@@ -31,18 +98,39 @@ public:
   ~ShadowMemory();
 public:
   T* getShadowMemorySlot(const uint64_t address);
+  T* getShadowMemorySlot(const uint64_t address, uint32_t& generation,
+                         uint32_t& pruneGeneration);
+  template<typename F>
+  void invalidateRange(const uint64_t lowerBound, const uint64_t upperBound,
+                       F invalidateSlot);
+  template<typename F>
+  void pruneHistory(uint32_t idleEpochs, F resetSlot);
   uint64_t getNumEntriesPerPage();
+  uint64_t getGranuleSize();
 
 private:
+  uint32_t _advanceGeneration();
+  template<typename F>
+  void _resetGenerations(F resetSlot);
   uint64_t _getPageIndex(const uint64_t address);
   uint64_t _genPageIndexMask(const uint64_t numBits, const uint64_t lowZeros);
   uint64_t _getL1PageIndex(const uint64_t address);
   uint64_t _getL2PageIndex(const uint64_t address);
   T* _getOrCreatePageForMemAddr(const uint64_t address);   
+  T* _getPageIfExists(const uint64_t address);
+  uint32_t* _getPageGenerations(T* pageBase);
+  uint32_t* _getPageTouchEpoch(T* pageBase);
 
 private:
   void*** _pageTable; 
+  std::atomic<uint32_t> _generation;
+  std::atomic<uint32_t> _pruneGeneration;
+  std::atomic<uint32_t> _regionEpoch;
+  McsLock _pagesLock;
+  std::vector<uint64_t> _pages; // an address covered by each shadow page
+  uint64_t _numGenBlocks;
   uint64_t _numEntriesPerPage;
+  uint64_t _shadowPageBytes;
   uint64_t _shadowPageIndexMask;
   uint64_t _pageOffsetShift;
   uint64_t _numL1PageTableEntries;
@@ -54,7 +142,7 @@ private:
 private: 
   static thread_local void* _cachedShadowPage;
   static thread_local void** _cachedL1Page;
-  void* _getShadowPage(const uint64_t numEntriesPerPage);
+  void* _getShadowPage(const uint64_t shadowPageBytes);
   void** _getL1Page(const uint64_t numL2PageTableEntries);
   void _saveShadowPage(void* shadowPage);
   void _saveL1Page(void** l1Page);
@@ -117,6 +205,19 @@ ShadowMemory<T>::ShadowMemory(const uint64_t l1PageTableBits,
 
   _numL1PageTableEntries = 1 << l1PageTableBits;
   _numL2PageTableEntries = 1 << l2PageTableBits;
+
+  /*
+   * The page generation, block generations and the region epoch in which
+   * the page was last touched are stored after the slots.
+   */
+  _numGenBlocks = std::max(_numEntriesPerPage >> GEN_BLOCK_BITS, 
+          static_cast<uint64_t>(1));
+  _shadowPageBytes = sizeof(T) * _numEntriesPerPage + 
+                     sizeof(uint32_t) * (2 + _numGenBlocks);
+  _generation = 0;
+  _pruneGeneration = 0;
+  _regionEpoch = 1;
+  mcsInit(&_pagesLock);
      
   // For l1PageTableBits = 20, this allocates a chunk of memory of size 
   // 2^20 * 8 = 8 Mb, which is managable.
@@ -134,7 +235,7 @@ ShadowMemory<T>::~ShadowMemory() {
     if (_pageTable[i] != 0) {
       for (int j = 0; j < _numL2PageTableEntries; ++j) {
         if (_pageTable[i][j] != 0) {
-          free(_pageTable[i][j]); //free the leaf shadow page
+          munmap(_pageTable[i][j], _shadowPageBytes); //free the leaf shadow page
         }
       }
       free(_pageTable[i]);
@@ -196,17 +297,224 @@ T* ShadowMemory<T>::_getOrCreatePageForMemAddr(const uint64_t address) {
   // now get the shadow page
   auto l2Index = _getL2PageIndex(address);
   if (_pageTable[l1Index][l2Index] == 0) {
-    auto freshShadowPage = _getShadowPage(_numEntriesPerPage);
+    auto freshShadowPage = _getShadowPage(_shadowPageBytes);
     auto success = __sync_bool_compare_and_swap(&_pageTable[l1Index][l2Index],
                                              0, freshShadowPage);
     if (!success) {
       _saveShadowPage(freshShadowPage);
+    } else {
+      McsNode node;
+      LockGuard guard(&_pagesLock, &node);
+      _pages.push_back(address);
     }
   }
   return static_cast<T*>(_pageTable[l1Index][l2Index]);
 }
 
 
+/*
+ * Given the memory address, return the corresponding slot in shadow memory 
+ * and the generation numbers that the slot has to be validated against. A
+ * slot whose own generation is older than `generation` has been invalidated
+ * by `invalidateRange` and should be reset before use. A slot whose own 
+ * generation is older than `pruneGeneration` only holds access records that
+ * have been pruned by `pruneHistory`. The page is marked as touched in the
+ * current region epoch.
+ */
+template<typename T>
+T* ShadowMemory<T>::getShadowMemorySlot(const uint64_t address, 
+                                        uint32_t& generation,
+                                        uint32_t& pruneGeneration) {
+  auto pageBase = _getOrCreatePageForMemAddr(address);   
+  auto pageIndex = _getPageIndex(address); 
+  auto generations = _getPageGenerations(pageBase);
+  auto pageGeneration = __atomic_load_n(&generations[0], __ATOMIC_RELAXED);
+  auto blockGeneration = __atomic_load_n(
+          &generations[1 + (pageIndex >> GEN_BLOCK_BITS)], __ATOMIC_RELAXED);
+  generation = std::max(pageGeneration, blockGeneration);
+  pruneGeneration = _pruneGeneration.load(std::memory_order_relaxed);
+  auto touchEpoch = _getPageTouchEpoch(pageBase);
+  auto regionEpoch = _regionEpoch.load(std::memory_order_relaxed);
+  if (__atomic_load_n(touchEpoch, __ATOMIC_RELAXED) != regionEpoch) {
+    __atomic_store_n(touchEpoch, regionEpoch, __ATOMIC_RELAXED);
+  }
+  return static_cast<T*>(pageBase + pageIndex);
+}
+
+/*
+ * Invalidate shadow memory slots for memory range [lowerBound, upperBound].
+ * Shadow pages that are fully covered by the range get a new page generation
+ * and generation blocks that are fully covered get a new block generation. 
+ * Only slots in generation blocks that partially overlap with the range are
+ * handed to `invalidateSlot` one by one, together with the mask of the bytes
+ * of the slot's granule that lie in the range. The mask covers the whole 
+ * granule except for the granules at the boundaries of the range, whose 
+ * bytes outside of the range stay valid. Shadow pages that have not been 
+ * allocated hold no access history and are skipped. The cost is thus 
+ * proportional to the number of pages in the range instead of the number of
+ * bytes.
+ */
+template<typename T>
+template<typename F>
+void ShadowMemory<T>::invalidateRange(const uint64_t lowerBound, 
+                                      const uint64_t upperBound,
+                                      F invalidateSlot) {
+  // 0 if the generations are exhausted, every slot is marked on its own
+  auto generation = _advanceGeneration();
+  auto granuleSize = getGranuleSize();
+  auto pageSize = static_cast<uint64_t>(1) << _l2PageTableShift;
+  auto blockSize = granuleSize << GEN_BLOCK_BITS;
+  auto addr = lowerBound & ~(granuleSize - 1);
+  while (addr <= upperBound) {
+    auto pageBase = addr & ~(pageSize - 1);
+    auto pageEnd = pageBase + pageSize - 1;
+    auto blockBase = addr & ~(blockSize - 1);
+    auto blockEnd = blockBase + blockSize - 1;
+    auto page = _getPageIfExists(addr);
+    auto generations = page ? _getPageGenerations(page) : nullptr;
+    uint64_t last;
+    if (!page) {
+      last = pageEnd;
+    } else if (generation != 0 && addr == pageBase && addr >= lowerBound &&
+               pageEnd <= upperBound) {
+      __atomic_store_n(&generations[0], generation, __ATOMIC_RELAXED);
+      last = pageEnd;
+    } else if (generation != 0 && addr == blockBase && addr >= lowerBound &&
+               blockEnd <= upperBound) {
+      auto blockIndex = _getPageIndex(addr) >> GEN_BLOCK_BITS;
+      __atomic_store_n(&generations[1 + blockIndex], generation, 
+              __ATOMIC_RELAXED);
+      last = blockEnd;
+    } else {
+      invalidateSlot(page + _getPageIndex(addr), 
+              getRangeByteMask(addr, granuleSize, lowerBound, upperBound));
+      last = addr + granuleSize - 1;
+    }
+    if (last >= upperBound) {
+      break;
+    }
+    addr = last + 1;
+  }
+}
+
+/*
+ * Called at the end of a region epoch, when every access recorded so far
+ * happens before any access to come. All access records are pruned at once
+ * by advancing the prune generation, slots are reset lazily upon next 
+ * access. Past GEN_RESET_THRESHOLD all generations are reset instead, see
+ * _resetGenerations. Shadow pages that have not been touched in the last 
+ * `idleEpochs` region epochs are returned to the system after their slots 
+ * are destroyed, 0 keeps all pages. The caller guarantees that no thread 
+ * accesses the shadow memory meanwhile.
+ */
+template<typename T>
+template<typename F>
+void ShadowMemory<T>::pruneHistory(uint32_t idleEpochs, F resetSlot) {
+  if (_generation.load(std::memory_order_relaxed) >= GEN_RESET_THRESHOLD) {
+    _resetGenerations(resetSlot);
+  } else {
+    auto generation = _generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    _pruneGeneration.store(generation, std::memory_order_relaxed);
+  }
+  auto regionEpoch = _regionEpoch.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (idleEpochs == 0) {
+    return;
+  }
+  McsNode node;
+  LockGuard guard(&_pagesLock, &node);
+  uint64_t i = 0;
+  while (i < _pages.size()) {
+    auto address = _pages[i];
+    auto pageBase = _getPageIfExists(address);
+    auto touchEpoch = *_getPageTouchEpoch(pageBase);
+    if (regionEpoch - touchEpoch > idleEpochs) {
+      _pageTable[_getL1PageIndex(address)][_getL2PageIndex(address)] = 0;
+      // slots may own spilled records, release them before the page
+      for (uint64_t j = 0; j < _numEntriesPerPage; ++j) {
+        pageBase[j].~T();
+      }
+      munmap(pageBase, _shadowPageBytes);
+      _pages[i] = _pages.back();
+      _pages.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+/*
+ * Return the shadow page containing the slot for the address, or nullptr if
+ * the shadow page has not been allocated yet.
+ */
+template<typename T>
+T* ShadowMemory<T>::_getPageIfExists(const uint64_t address) {
+  auto l1Page = _pageTable[_getL1PageIndex(address)];
+  if (l1Page == 0) {
+    return nullptr;
+  }
+  return static_cast<T*>(l1Page[_getL2PageIndex(address)]);
+}
+
+/*
+ * Advance the generation counter and return the new generation. Return 0 if
+ * the counter has reached GEN_MAX, it is only lowered by _resetGenerations.
+ */
+template<typename T>
+uint32_t ShadowMemory<T>::_advanceGeneration() {
+  auto generation = _generation.load(std::memory_order_relaxed);
+  do {
+    if (generation >= GEN_MAX) {
+      return 0;
+    }
+  } while (!_generation.compare_exchange_weak(generation, generation + 1, 
+              std::memory_order_relaxed));
+  return generation + 1;
+}
+
+/*
+ * Reset the generation counters and the generation numbers of all pages and
+ * blocks to 0. Each slot is handed to `resetSlot` to drop its records and 
+ * reset its own generation, along with whether it has been invalidated, i.e.
+ * is older than its page or block. Called by pruneHistory, so the records
+ * are pruned as well.
+ */
+template<typename T>
+template<typename F>
+void ShadowMemory<T>::_resetGenerations(F resetSlot) {
+  McsNode node;
+  LockGuard guard(&_pagesLock, &node);
+  for (const auto& address : _pages) {
+    auto pageBase = _getPageIfExists(address);
+    auto generations = _getPageGenerations(pageBase);
+    for (uint64_t j = 0; j < _numEntriesPerPage; ++j) {
+      auto generation = std::max(generations[0], 
+              generations[1 + (j >> GEN_BLOCK_BITS)]);
+      resetSlot(pageBase + j, pageBase[j].getGeneration() < generation);
+    }
+    memset(generations, 0, sizeof(uint32_t) * (1 + _numGenBlocks));
+  }
+  _generation.store(0, std::memory_order_relaxed);
+  _pruneGeneration.store(0, std::memory_order_relaxed);
+}
+
+/*
+ * The generation numbers of a shadow page are stored right after its slots.
+ * Index 0 is the page generation, index 1 + i is the generation of block i.
+ */
+template<typename T>
+uint32_t* ShadowMemory<T>::_getPageGenerations(T* pageBase) {
+  return reinterpret_cast<uint32_t*>(pageBase + _numEntriesPerPage);
+}
+
+/*
+ * The region epoch in which a shadow page was last touched is stored after
+ * its generation numbers.
+ */
+template<typename T>
+uint32_t* ShadowMemory<T>::_getPageTouchEpoch(T* pageBase) {
+  return _getPageGenerations(pageBase) + 1 + _numGenBlocks;
+}
+
 template<typename T>
 uint64_t ShadowMemory<T>::_getPageIndex(const uint64_t address) {
   return (address & _shadowPageIndexMask) >> _pageOffsetShift;
@@ -218,6 +526,14 @@ uint64_t ShadowMemory<T>::getNumEntriesPerPage() {
   return _numEntriesPerPage;
 }
 
+/*
+ * Return the number of application bytes that share one shadow memory slot.
+ */
+template<typename T>
+uint64_t ShadowMemory<T>::getGranuleSize() {
+  return static_cast<uint64_t>(1) << _pageOffsetShift;
+}
+
 /*
  * Helper function to get an allocation of l1 page, which is a array of 
  * pointers to shadow pages. Use thread local storage for a caching.
@@ -241,17 +557,20 @@ void** ShadowMemory<T>::_getL1Page(uint64_t numL2PageTableEntries) {
 
 /*
  * Helper function to get an allocation of shadow page, which contains 
- * entries of access history type T. 
+ * entries of access history type T. Shadow pages are mapped directly rather
+ * than allocated from the heap, so that entries start at a page boundary and
+ * an entry never straddles two cache lines.
  */
 template<typename T>
-void* ShadowMemory<T>::_getShadowPage(const uint64_t numEntriesPerPage) {
+void* ShadowMemory<T>::_getShadowPage(const uint64_t shadowPageBytes) {
   void* result;
   if (_cachedShadowPage != nullptr) {
     result = _cachedShadowPage;
     _cachedShadowPage = nullptr;
   } else { 
-    auto tmp = calloc(1, sizeof(T) * numEntriesPerPage);
-    if (tmp == NULL) {
+    auto tmp = mmap(nullptr, shadowPageBytes, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (tmp == MAP_FAILED) {
       RAW_LOG(FATAL, "%s\n", "cannot allocate shadowpage");
     }
     result = static_cast<void*>(tmp);
@@ -291,6 +610,396 @@ uint64_t ShadowMemory<T>::_genPageIndexMask(uint64_t numBits, uint64_t lowZeros)
   return (1 << numBits) - (1 << lowZeros);
 }
 
+/*
+ * FlatShadowMemory is an alternative shadow memory backend. It reserves the 
+ * shadow memory for the application address ranges defined above as one 
+ * mmap'd region with MAP_NORESERVE. The kernel zero-fills each page of the 
+ * region on first touch, so a slot is computed from the address with a 
+ * range check, a shift and an add, without walking page tables and without
+ * installing freshly allocated pages with compare-and-swap. Addresses that
+ * fall out of these ranges are served by a two-level ShadowMemory.
+ */
+template<typename T>
+class FlatShadowMemory {
+
+public:
+  FlatShadowMemory(const uint64_t l1PageTableBits = 20, 
+                   const uint64_t l2PageTableBits = 12,
+                   const uint64_t numMemAddrBits = 48,
+                   Granularity granularity = eByteLevel);
+
+  ~FlatShadowMemory();
+public:
+  T* getShadowMemorySlot(const uint64_t address);
+  T* getShadowMemorySlot(const uint64_t address, uint32_t& generation,
+                         uint32_t& pruneGeneration);
+  template<typename F>
+  void invalidateRange(const uint64_t lowerBound, const uint64_t upperBound,
+                       F invalidateSlot);
+  template<typename F>
+  void pruneHistory(uint32_t idleEpochs, F resetSlot);
+  uint64_t getNumEntriesPerPage();
+  uint64_t getGranuleSize();
+
+private:
+  uint32_t _advanceGeneration();
+  template<typename F>
+  void _resetGenerations(F resetSlot);
+  bool _getSlotIndex(const uint64_t address, uint64_t& slotIndex);
+  bool _inSameRegion(const uint64_t lowerBound, const uint64_t upperBound);
+  void _touchPage(uint64_t pageIndex, uint32_t regionEpoch);
+
+private:
+  T* _base; 
+  uint32_t* _pageGenerations;
+  uint32_t* _blockGenerations;
+  uint32_t* _pageTouchEpochs; // 0 if the page is not touched
+  std::atomic<uint32_t> _generation;
+  std::atomic<uint32_t> _pruneGeneration;
+  std::atomic<uint32_t> _regionEpoch;
+  McsLock _pagesLock;
+  std::vector<uint64_t> _pages; // indices of touched pages
+  uint64_t _regionSize;
+  uint64_t _generationsSize;
+  uint64_t _touchEpochsSize;
+  uint64_t _granuleShift;
+  uint64_t _pageShift;
+  ShadowMemory<T> _fallback;
+};
+
+template<typename T>
+FlatShadowMemory<T>::FlatShadowMemory(const uint64_t l1PageTableBits,
+                                      const uint64_t l2PageTableBits,
+                                      const uint64_t numMemAddrBits, 
+                                      Granularity granularity): 
+   _fallback(l1PageTableBits, l2PageTableBits, numMemAddrBits, granularity) {
+  DLOG(INFO) << "FlatShadowMemory constructor ";
+  _granuleShift = 0;
+  while ((static_cast<uint64_t>(1) << _granuleShift) < 
+          _fallback.getGranuleSize()) {
+    _granuleShift++;
+  }
+  uint64_t numAppBytes = (FLAT_LOW_APP_END - FLAT_LOW_APP_BEGIN) + 
+                         (FLAT_MID_APP_END - FLAT_MID_APP_BEGIN) + 
+                         (FLAT_HIGH_APP_END - FLAT_HIGH_APP_BEGIN);
+  _regionSize = (numAppBytes >> _granuleShift) * sizeof(T);
+  auto flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+  auto hint = reinterpret_cast<void*>(FLAT_SHADOW_BASE);
+  auto tmp = mmap(hint, _regionSize, PROT_READ | PROT_WRITE, 
+          flags | MAP_FIXED_NOREPLACE, -1, 0);
+  if (tmp == MAP_FAILED) {
+    // the preferred location is taken, let the kernel place the region
+    tmp = mmap(nullptr, _regionSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+  }
+  if (tmp == MAP_FAILED) {
+    LOG(FATAL) << "cannot reserve flat shadow memory";
+  }
+  _base = static_cast<T*>(tmp);
+  // generation numbers for pages and generation blocks
+  _pageShift = 0;
+  while ((static_cast<uint64_t>(1) << _pageShift) < 
+          _fallback.getNumEntriesPerPage()) {
+    _pageShift++;
+  }
+  auto numSlots = numAppBytes >> _granuleShift;
+  auto numPages = std::max(numSlots >> _pageShift, static_cast<uint64_t>(1));
+  auto numBlocks = std::max(numSlots >> GEN_BLOCK_BITS, 
+          static_cast<uint64_t>(1));
+  // page and block generations, reset at once by _resetGenerations
+  _generationsSize = sizeof(uint32_t) * (numPages + numBlocks);
+  tmp = mmap(nullptr, _generationsSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (tmp == MAP_FAILED) {
+    LOG(FATAL) << "cannot reserve flat shadow memory generations";
+  }
+  _pageGenerations = static_cast<uint32_t*>(tmp);
+  _blockGenerations = _pageGenerations + numPages;
+  _touchEpochsSize = sizeof(uint32_t) * numPages;
+  tmp = mmap(nullptr, _touchEpochsSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (tmp == MAP_FAILED) {
+    LOG(FATAL) << "cannot reserve flat shadow memory touch epochs";
+  }
+  _pageTouchEpochs = static_cast<uint32_t*>(tmp);
+  _generation = 0;
+  _pruneGeneration = 0;
+  _regionEpoch = 1;
+  mcsInit(&_pagesLock);
+}
+
+template<typename T>
+FlatShadowMemory<T>::~FlatShadowMemory() {
+  munmap(static_cast<void*>(_base), _regionSize);
+  munmap(static_cast<void*>(_pageGenerations), _generationsSize);
+  munmap(static_cast<void*>(_pageTouchEpochs), _touchEpochsSize);
+}
+
+/*
+ * Compute the index of the slot for the address in the flat shadow region.
+ * The three application ranges are laid out back to back in the shadow 
+ * region. Unsigned subtraction folds the lower and upper bound check of a 
+ * range into one comparison. Return false if the address is not covered by
+ * the flat shadow region.
+ */
+template<typename T>
+bool FlatShadowMemory<T>::_getSlotIndex(const uint64_t address, 
+                                        uint64_t& slotIndex) {
+  uint64_t offset;
+  if (address < FLAT_LOW_APP_END) {
+    offset = address;
+  } else if (address - FLAT_MID_APP_BEGIN < 
+             FLAT_MID_APP_END - FLAT_MID_APP_BEGIN) {
+    offset = address - FLAT_MID_APP_BEGIN + FLAT_LOW_APP_END;
+  } else if (address - FLAT_HIGH_APP_BEGIN < 
+             FLAT_HIGH_APP_END - FLAT_HIGH_APP_BEGIN) {
+    offset = address - FLAT_HIGH_APP_BEGIN + FLAT_LOW_APP_END + 
+             (FLAT_MID_APP_END - FLAT_MID_APP_BEGIN);
+  } else {
+    return false;
+  }
+  slotIndex = offset >> _granuleShift;
+  return true;
+}
+
+/*
+ * Return true if [lowerBound, upperBound] lies in one of the application
+ * ranges covered by the flat shadow region.
+ */
+template<typename T>
+bool FlatShadowMemory<T>::_inSameRegion(const uint64_t lowerBound, 
+                                        const uint64_t upperBound) {
+  return upperBound < FLAT_LOW_APP_END || 
+         (lowerBound >= FLAT_MID_APP_BEGIN && upperBound < FLAT_MID_APP_END) ||
+         (lowerBound >= FLAT_HIGH_APP_BEGIN && upperBound < FLAT_HIGH_APP_END);
+}
+
+/*
+ * Given the memory address, return the corresponding slot in shadow memory.
+ */
+template<typename T>
+T* FlatShadowMemory<T>::getShadowMemorySlot(const uint64_t address) {
+  uint64_t slotIndex;
+  if (!_getSlotIndex(address, slotIndex)) {
+    return _fallback.getShadowMemorySlot(address);
+  }
+  return _base + slotIndex;
+}
+
+/*
+ * Given the memory address, return the corresponding slot in shadow memory
+ * and the generation numbers the slot has to be validated against, see
+ * ShadowMemory::getShadowMemorySlot.
+ */
+template<typename T>
+T* FlatShadowMemory<T>::getShadowMemorySlot(const uint64_t address,
+                                            uint32_t& generation,
+                                            uint32_t& pruneGeneration) {
+  uint64_t slotIndex;
+  if (!_getSlotIndex(address, slotIndex)) {
+    return _fallback.getShadowMemorySlot(address, generation, 
+            pruneGeneration);
+  }
+  auto pageIndex = slotIndex >> _pageShift;
+  auto pageGeneration = __atomic_load_n(&_pageGenerations[pageIndex], 
+          __ATOMIC_RELAXED);
+  auto blockGeneration = __atomic_load_n(&_blockGenerations[
+          slotIndex >> GEN_BLOCK_BITS], __ATOMIC_RELAXED);
+  generation = std::max(pageGeneration, blockGeneration);
+  pruneGeneration = _pruneGeneration.load(std::memory_order_relaxed);
+  auto regionEpoch = _regionEpoch.load(std::memory_order_relaxed);
+  if (__atomic_load_n(&_pageTouchEpochs[pageIndex], __ATOMIC_RELAXED) != 
+          regionEpoch) {
+    _touchPage(pageIndex, regionEpoch);
+  }
+  return _base + slotIndex;
+}
+
+/*
+ * Mark the page as touched in the region epoch. A page touched for the first
+ * time is added to the list of touched pages.
+ */
+template<typename T>
+void FlatShadowMemory<T>::_touchPage(uint64_t pageIndex, 
+                                     uint32_t regionEpoch) {
+  auto lastEpoch = __atomic_exchange_n(&_pageTouchEpochs[pageIndex], 
+          regionEpoch, __ATOMIC_RELAXED);
+  if (lastEpoch == 0) {
+    McsNode node;
+    LockGuard guard(&_pagesLock, &node);
+    _pages.push_back(pageIndex);
+  }
+}
+
+/*
+ * Prune all access records at the end of a region epoch, and return pages
+ * that have not been touched in the last `idleEpochs` region epochs to the
+ * system, see ShadowMemory::pruneHistory. The slots of a returned page are
+ * destroyed first, and the kernel zero-fills the page on next touch, which 
+ * resets its slots to empty access histories.
+ */
+template<typename T>
+template<typename F>
+void FlatShadowMemory<T>::pruneHistory(uint32_t idleEpochs, F resetSlot) {
+  _fallback.pruneHistory(idleEpochs, resetSlot);
+  if (_generation.load(std::memory_order_relaxed) >= GEN_RESET_THRESHOLD) {
+    _resetGenerations(resetSlot);
+  } else {
+    auto generation = _generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    _pruneGeneration.store(generation, std::memory_order_relaxed);
+  }
+  auto regionEpoch = _regionEpoch.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (idleEpochs == 0) {
+    return;
+  }
+  auto pageBytes = sizeof(T) << _pageShift;
+  McsNode node;
+  LockGuard guard(&_pagesLock, &node);
+  uint64_t i = 0;
+  while (i < _pages.size()) {
+    auto pageIndex = _pages[i];
+    if (regionEpoch - _pageTouchEpochs[pageIndex] > idleEpochs) {
+      auto page = reinterpret_cast<char*>(_base) + pageIndex * pageBytes;
+      // slots may own spilled records, release them before the page
+      auto slots = _base + (pageIndex << _pageShift);
+      for (uint64_t j = 0; j < (static_cast<uint64_t>(1) << _pageShift); ++j) {
+        slots[j].~T();
+      }
+      if (madvise(static_cast<void*>(page), pageBytes, MADV_DONTNEED) != 0) {
+        RAW_LOG(WARNING, "cannot release shadow page %p", page);
+      }
+      _pageTouchEpochs[pageIndex] = 0;
+      _pages[i] = _pages.back();
+      _pages.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+/*
+ * Invalidate shadow memory slots for memory range [lowerBound, upperBound]
+ * in O(pages), see ShadowMemory::invalidateRange. A range that is not fully
+ * covered by one application range is handed to the fallback shadow memory
+ * as a whole.
+ */
+template<typename T>
+template<typename F>
+void FlatShadowMemory<T>::invalidateRange(const uint64_t lowerBound, 
+                                          const uint64_t upperBound,
+                                          F invalidateSlot) {
+  if (!_inSameRegion(lowerBound, upperBound)) {
+    _fallback.invalidateRange(lowerBound, upperBound, invalidateSlot);
+    return;
+  }
+  // 0 if the generations are exhausted, every slot is marked on its own
+  auto generation = _advanceGeneration();
+  uint64_t lowerIndex, upperIndex;
+  _getSlotIndex(lowerBound, lowerIndex);
+  _getSlotIndex(upperBound, upperIndex);
+  auto granuleSize = getGranuleSize();
+  auto lowerBase = lowerBound & ~(granuleSize - 1);
+  auto upperBase = upperBound & ~(granuleSize - 1);
+  // granules at the boundaries only partially covered by the range
+  auto lowerMask = getRangeByteMask(lowerBase, granuleSize, lowerBound, 
+          upperBound);
+  auto upperMask = getRangeByteMask(upperBase, granuleSize, lowerBound, 
+          upperBound);
+  auto fullMask = getGranuleByteMask(granuleSize);
+  // first and last slot whose granule is fully covered by the range
+  auto firstFull = lowerMask == fullMask ? lowerIndex : lowerIndex + 1;
+  auto lastFull = upperMask == fullMask ? upperIndex : upperIndex - 1;
+  auto pageMask = (static_cast<uint64_t>(1) << _pageShift) - 1;
+  auto blockMask = (static_cast<uint64_t>(1) << GEN_BLOCK_BITS) - 1;
+  auto slotIndex = lowerIndex;
+  while (slotIndex <= upperIndex) {
+    uint64_t last;
+    if (generation != 0 && (slotIndex & pageMask) == 0 && 
+        slotIndex >= firstFull && (slotIndex | pageMask) <= lastFull) {
+      __atomic_store_n(&_pageGenerations[slotIndex >> _pageShift], 
+              generation, __ATOMIC_RELAXED);
+      last = slotIndex | pageMask;
+    } else if (generation != 0 && (slotIndex & blockMask) == 0 && 
+               slotIndex >= firstFull && (slotIndex | blockMask) <= lastFull) {
+      __atomic_store_n(&_blockGenerations[slotIndex >> GEN_BLOCK_BITS], 
+              generation, __ATOMIC_RELAXED);
+      last = slotIndex | blockMask;
+    } else {
+      auto byteMask = fullMask;
+      if (slotIndex == lowerIndex) {
+        byteMask = lowerMask;
+      } else if (slotIndex == upperIndex) {
+        byteMask = upperMask;
+      }
+      invalidateSlot(_base + slotIndex, byteMask);
+      last = slotIndex;
+    }
+    slotIndex = last + 1;
+  }
+}
+
+/*
+ * See ShadowMemory::_advanceGeneration.
+ */
+template<typename T>
+uint32_t FlatShadowMemory<T>::_advanceGeneration() {
+  auto generation = _generation.load(std::memory_order_relaxed);
+  do {
+    if (generation >= GEN_MAX) {
+      return 0;
+    }
+  } while (!_generation.compare_exchange_weak(generation, generation + 1, 
+              std::memory_order_relaxed));
+  return generation + 1;
+}
+
+/*
+ * Reset all generation numbers to 0, see ShadowMemory::_resetGenerations.
+ * Only slots of touched pages may hold records, the slots of other pages are
+ * zero. Generation numbers are also set on pages that have never been 
+ * touched, so the whole generation region is zero-filled.
+ */
+template<typename T>
+template<typename F>
+void FlatShadowMemory<T>::_resetGenerations(F resetSlot) {
+  McsNode node;
+  LockGuard guard(&_pagesLock, &node);
+  auto numSlotsPerPage = static_cast<uint64_t>(1) << _pageShift;
+  for (const auto& pageIndex : _pages) {
+    auto pageGeneration = _pageGenerations[pageIndex];
+    auto slotIndex = pageIndex << _pageShift;
+    for (uint64_t j = 0; j < numSlotsPerPage; ++j, ++slotIndex) {
+      auto generation = std::max(pageGeneration, 
+              _blockGenerations[slotIndex >> GEN_BLOCK_BITS]);
+      resetSlot(_base + slotIndex, _base[slotIndex].getGeneration() < 
+              generation);
+    }
+  }
+  if (madvise(static_cast<void*>(_pageGenerations), _generationsSize, 
+              MADV_DONTNEED) != 0) {
+    RAW_LOG(FATAL, "cannot reset flat shadow memory generations");
+  }
+  _generation.store(0, std::memory_order_relaxed);
+  _pruneGeneration.store(0, std::memory_order_relaxed);
+}
+
+template<typename T>
+uint64_t FlatShadowMemory<T>::getNumEntriesPerPage() {
+  return _fallback.getNumEntriesPerPage();
+}
+
+template<typename T>
+uint64_t FlatShadowMemory<T>::getGranuleSize() {
+  return static_cast<uint64_t>(1) << _granuleShift;
 }
 
+/*
+ * The shadow memory backend used for access history is selected at build 
+ * time. FLAT_SHADOW_MEMORY selects the flat mmap'd backend.
+ */
+#ifdef FLAT_SHADOW_MEMORY
+template<typename T>
+using RompShadowMemory = FlatShadowMemory<T>;
+#else
+template<typename T>
+using RompShadowMemory = ShadowMemory<T>;
+#endif
 
+}
@@ -0,0 +1,196 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <glog/logging.h>
+#include <glog/raw_logging.h>
+#include <new>
+#include <utility>
+
+/*
+ * Each thread carves slab blocks out of chunks of this size. Chunks are
+ * aligned to their size and never returned to the system.
+ */
+#define SLAB_CHUNK_SIZE (64 * 1024)
+
+/*
+ * Slab blocks are multiples of this size, which keeps every block aligned
+ * for any fundamental type.
+ */
+#define SLAB_BLOCK_ALIGN 16
+
+namespace romp {
+
+constexpr size_t slabBlockSize(size_t size) {
+  return (size + SLAB_BLOCK_ALIGN - 1) / SLAB_BLOCK_ALIGN * SLAB_BLOCK_ALIGN;
+}
+
+/*
+ * State of the slab of one thread. Blocks freed by other threads are pushed
+ * on `remoteFreeList`, which the owner takes over as a whole once its own 
+ * freelist runs dry. The state is never freed, so that blocks can still be
+ * returned to it after the thread exits.
+ */
+typedef struct SlabState {
+  void* freeList;
+  char* chunkCur;
+  char* chunkEnd;
+  std::atomic<void*> remoteFreeList;
+  SlabState(): freeList(nullptr), chunkCur(nullptr), chunkEnd(nullptr),
+      remoteFreeList(nullptr) {}
+} SlabState;
+
+/*
+ * Header at the start of each chunk, so that a block finds its owner slab.
+ */
+typedef struct SlabChunkHeader {
+  SlabState* owner;
+} SlabChunkHeader;
+
+#define SLAB_CHUNK_HEADER_SIZE slabBlockSize(sizeof(SlabChunkHeader))
+
+/*
+ * Per-thread slab of blocks of `BlockSize` bytes for runtime objects that
+ * are created and destroyed at a high rate, such as task data, parallel
+ * region data and label nodes. A freed block goes back to the slab of the
+ * thread that allocated it, so that a thread creating objects that other 
+ * threads destroy, e.g., the producer of tasks, reuses their blocks instead
+ * of carving new chunks. Objects of the same block size share one slab.
+ */
+template<size_t BlockSize>
+class BlockSlab {
+
+public:
+  static void* alloc();
+  static void free(void* block);
+private:
+  static SlabState* _getState();
+  static thread_local SlabState* _state;
+};
+
+template<size_t BlockSize>
+thread_local SlabState* BlockSlab<BlockSize>::_state = nullptr;
+
+template<size_t BlockSize>
+SlabState* BlockSlab<BlockSize>::_getState() {
+  if (!_state) {
+    _state = new SlabState();
+  }
+  return _state;
+}
+
+/*
+ * Get a block, first from the freelist, then from the blocks freed by other
+ * threads, then from the current chunk.
+ */
+template<size_t BlockSize>
+void* BlockSlab<BlockSize>::alloc() {
+  static_assert(BlockSize % SLAB_BLOCK_ALIGN == 0 &&
+          BlockSize <= SLAB_CHUNK_SIZE - SLAB_CHUNK_HEADER_SIZE, 
+          "unexpected slab block size");
+  auto state = _getState();
+  if (!state->freeList) {
+    state->freeList = state->remoteFreeList.exchange(nullptr, 
+            std::memory_order_acquire);
+  }
+  if (state->freeList) {
+    auto block = state->freeList;
+    state->freeList = *static_cast<void**>(block);
+    return block;
+  }
+  if (state->chunkCur == nullptr ||
+      static_cast<size_t>(state->chunkEnd - state->chunkCur) < BlockSize) {
+    auto chunk = static_cast<char*>(aligned_alloc(SLAB_CHUNK_SIZE,
+                SLAB_CHUNK_SIZE));
+    if (!chunk) {
+      RAW_LOG(FATAL, "cannot allocate slab chunk");
+    }
+    reinterpret_cast<SlabChunkHeader*>(chunk)->owner = state;
+    state->chunkCur = chunk + SLAB_CHUNK_HEADER_SIZE;
+    state->chunkEnd = chunk + SLAB_CHUNK_SIZE;
+  }
+  auto block = state->chunkCur;
+  state->chunkCur += BlockSize;
+  return block;
+}
+
+/*
+ * Return the block to the slab of the thread that allocated it.
+ */
+template<size_t BlockSize>
+void BlockSlab<BlockSize>::free(void* block) {
+  auto chunk = reinterpret_cast<uintptr_t>(block) & 
+      ~static_cast<uintptr_t>(SLAB_CHUNK_SIZE - 1);
+  auto owner = reinterpret_cast<SlabChunkHeader*>(chunk)->owner;
+  if (owner == _state) {
+    *static_cast<void**>(block) = owner->freeList;
+    owner->freeList = block;
+    return;
+  }
+  auto head = owner->remoteFreeList.load(std::memory_order_relaxed);
+  do {
+    *static_cast<void**>(block) = head;
+  } while (!owner->remoteFreeList.compare_exchange_weak(head, block, 
+              std::memory_order_release, std::memory_order_relaxed));
+}
+
+/*
+ * Construct an object of type T in a slab block.
+ */
+template<typename T, typename... Args>
+T* slabNew(Args&&... args) {
+  auto block = BlockSlab<slabBlockSize(sizeof(T))>::alloc();
+  return new (block) T(std::forward<Args>(args)...);
+}
+
+/*
+ * Destroy an object constructed by slabNew() and recycle its block.
+ */
+template<typename T>
+void slabDelete(T* object) {
+  if (object == nullptr) {
+    return;
+  }
+  object->~T();
+  BlockSlab<slabBlockSize(sizeof(T))>::free(object);
+}
+
+/*
+ * Allocator adapter for the standard library, so that std::shared_ptr
+ * control blocks come from the slabs as well. Arrays are left to the heap.
+ */
+template<typename T>
+class SlabAllocator {
+
+public:
+  typedef T value_type;
+  SlabAllocator() {}
+  template<typename U>
+  SlabAllocator(const SlabAllocator<U>&) {}
+  T* allocate(size_t n) {
+    if (n != 1) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(BlockSlab<slabBlockSize(sizeof(T))>::alloc());
+  }
+  void deallocate(T* object, size_t n) {
+    if (n != 1) {
+      ::operator delete(object);
+      return;
+    }
+    BlockSlab<slabBlockSize(sizeof(T))>::free(object);
+  }
+};
+
+template<typename T, typename U>
+bool operator==(const SlabAllocator<T>&, const SlabAllocator<U>&) {
+  return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const SlabAllocator<T>&, const SlabAllocator<U>&) {
+  return false;
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "QueryFuncs.h"
+
+namespace romp {
+
+/*
+ * TaskContext caches the openmp context of the task currently executed by
+ * the thread. It holds the same information `prepareAllInfo` queries from
+ * the runtime. The current task, its frame, the parallel region and the
+ * thread data only change at ompt callbacks, so the callbacks invalidate the
+ * context and it is refreshed by querying the runtime once on the next
+ * memory access. Checking an access then reads the context from thread local
+ * storage instead of calling into the runtime.
+ */
+typedef struct TaskContext {
+  bool valid;
+  int taskType;
+  int teamSize;
+  int threadNum;
+  void* parRegionData;
+  void* threadData;
+  AllTaskInfo allTaskInfo;
+} TaskContext;
+
+extern thread_local TaskContext tTaskContext;
+
+bool refreshTaskContext();
+void validateTaskContext();
+
+/*
+ * Called by callbacks which may change the current task, the parallel region
+ * or the thread data of the calling thread.
+ */
+inline void invalidateTaskContext() {
+  tTaskContext.valid = false;
+}
+
+/*
+ * Return the context of the current task, or nullptr if the core information
+ * such as the task data is not available yet.
+ */
+inline const TaskContext* getTaskContext() {
+  if (!tTaskContext.valid && !refreshTaskContext()) {
+    return nullptr;
+  }
+#ifdef VALIDATE_TASK_CONTEXT
+  validateTaskContext();
+#endif
+  return &tTaskContext;
+}
+
+}
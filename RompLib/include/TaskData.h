@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -6,6 +7,17 @@ namespace romp {
 class Label;
 class LockSet;
 
+/*
+ * Explicit children of a task that are not synced with it yet and were 
+ * created in the same taskgroup. The taskgroup is identified by `groupKey`,
+ * made of the label length, taskgroup id and taskgroup level of the parent
+ * task when it created the children.
+ */
+typedef struct ChildTaskBucket {
+  uint64_t groupKey;
+  std::vector<void*> children;
+} ChildTaskBucket;
+
 /*
  * TaskData struct records information related to a task.
  * A pointer to this struct is stored in openmp runtime 
@@ -14,22 +26,41 @@ class LockSet;
  */
 typedef struct TaskData {
   std::shared_ptr<Label> label;
-  std::shared_ptr<LockSet> lockSet;
+  const LockSet* lockSet; // interned lockset, nullptr if no lock is held
   bool inReduction;
-  std::vector<void*> childExpTaskData;
+  std::vector<ChildTaskBucket> childExpTaskBuckets;
   void* exitFrame; 
-  int expLocalId; // if the task is explicit, store its local id in par region
+  int expLocalId; // local id in par region, -1 - thread index if implicit
+  int parentLocalId; // local id of the parent if the task is explicit
   bool isMutexTask;
   bool isExplicitTask; 
+  Label* internedLabel; // label last interned for the task
+  uint32_t labelId; // id of `internedLabel`, the task holds a reference
+  uint32_t ownerId; // id of the current ownership epoch, 0 if not assigned
+  uint32_t teamId; // team the task is bound to, 0 for the initial task
+  uint32_t barrierEpoch; // number of team barriers completed before the task
+  std::atomic<int> refCount; // references from the runtime and the parent
   TaskData() {
     label = nullptr;
     lockSet = nullptr;
     inReduction = false;
     exitFrame = nullptr;
     expLocalId = 0;
+    parentLocalId = 0;
     isMutexTask = false;
     isExplicitTask = false;
+    internedLabel = nullptr;
+    labelId = 0;
+    ownerId = 0;
+    teamId = 0;
+    barrierEpoch = 0;
+    refCount.store(1, std::memory_order_relaxed);
   }
 } TaskData;
 
+void addExpChildTask(TaskData* taskData, TaskData* child, uint64_t groupKey);
+ChildTaskBucket* findExpChildBucket(TaskData* taskData, uint64_t groupKey);
+void retainTaskData(TaskData* taskData);
+void releaseTaskData(TaskData* taskData);
+
 }
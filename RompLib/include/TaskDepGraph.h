@@ -1,28 +1,149 @@
 #pragma once
+#include <atomic>
 #include <ompt.h>
-#include <unordered_map>
 #include <vector>
 
+#include "McsLock.h"
+
+/*
+ * Initial number of slots of the dependence variable map, a power of two.
+ */
+#define DEP_MAP_INIT_SIZE 16
+
+/*
+ * Number of shards of the dependence variable map, a power of two. Tasks
+ * with dependences on variables of different shards register concurrently.
+ */
+#define DEP_GRAPH_SHARDS 16
+
+/*
+ * Nodes of the dependence graph are stored in chunks that never move. Chunk
+ * k holds 2^(DEP_NODE_CHUNK_BITS + k) nodes, so that DEP_NODE_NUM_CHUNKS
+ * chunks cover all non-negative int ids.
+ */
+#define DEP_NODE_CHUNK_BITS 10
+#define DEP_NODE_NUM_CHUNKS (32 - DEP_NODE_CHUNK_BITS)
+
+/*
+ * Number of times a path query retries an optimistic read of the index
+ * before it takes the index lock.
+ */
+#define DEP_INDEX_READ_RETRIES 8
+
 namespace romp {
 
+struct TaskData;
+
+/*
+ * Sorted pairs of chain and position, see DepNode. A list is updated in 
+ * place while it has room. A list that is outgrown is kept until the graph
+ * is destroyed, because path queries may still read it. Capacities double,
+ * so the retired lists of a node take no more room than its current one.
+ */
+typedef struct AncestorList {
+  int capacity;
+  int size;
+  std::pair<int, int>* entries;
+} AncestorList;
+
+/*
+ * A node of the task dependence graph. Nodes are partitioned into chains, 
+ * each node of a chain reaches the next one. For every chain with a node 
+ * that reaches this node, `ancestors` records the last position on the 
+ * chain that does, sorted by chain. `chain` is -1 until the node is put 
+ * on a chain. Fields read by path queries are accessed atomically, 
+ * `successors` is only used under the index lock.
+ */
+typedef struct DepNode {
+  int chain;
+  int position;
+  AncestorList* ancestors;
+  std::vector<int> successors;
+  DepNode(): chain(-1), position(0), ancestors(nullptr) {}
+} DepNode;
+
+/*
+ * Frontier of the sibling tasks that depend on one variable. A new task with an
+ * `in` dependence depends on `writers`: the last task with an `out` or 
+ * `inout` dependence, or the current group of `mutexinoutset` tasks. A new 
+ * task with any other dependence depends on `readers`, the `in` tasks since
+ * `writers`, as well as on `writers`. Tasks of a `mutexinoutset` group do 
+ * not depend on each other, they all depend on `groupPreds`. Older tasks 
+ * are reached through the frontier and are dropped from it.
+ */
+typedef struct DepFrontier {
+  std::vector<int> writers;
+  std::vector<int> readers;
+  std::vector<int> groupPreds;
+  bool isMutexGroup;
+  DepFrontier(): isMutexGroup(false) {}
+} DepFrontier;
+
+/*
+ * Slot of the open addressing map from the parent task and the dependence
+ * variable to the frontier. Dependences only order sibling tasks, so each
+ * parent has its own frontier of a variable. The slot is empty if 
+ * `variable` is nullptr.
+ */
+typedef struct DepSlot {
+  void* variable;
+  int parentId; // local id of the parent task
+  DepFrontier frontier;
+  DepSlot(): variable(nullptr), parentId(0) {}
+} DepSlot;
+
+/*
+ * Shard of the dependence variable map, an open addressing map from parent
+ * and variable to frontier guarded by `lock`.
+ */
+typedef struct alignas(64) DepShard {
+  McsLock lock;
+  std::vector<DepSlot> slots;
+  size_t numVariables;
+  DepShard(): slots(DEP_MAP_INIT_SIZE), numVariables(0) { mcsInit(&lock); }
+} DepShard;
+
 /*
  * Class TaskDepGraph maintains a directed acylic graph using map.
- * Each node is represented by the pointer to task's allocated TaskData data
- * structure. There exists a directed edge from node a to node b if task b 
- * is dependent on task a, i.e., task a happens before task b
+ * Each node is represented by the local id of an explicit task in the 
+ * parallel region, so that the graph does not refer to task data of tasks
+ * that have completed. There exists a directed edge from node a to node b 
+ * if task b is dependent on task a, i.e., task a happens before task b.
+ * Reachability is maintained incrementally as edges are added, so that a
+ * path query is a binary search over the chains reaching the target.
+ * The graph is safe for concurrent use. Frontiers are updated under the lock
+ * of the shard of the variable, the new edges of a task are then added to 
+ * the reachability index under `_indexLock`. Path queries do not take the 
+ * lock, the index is a seqlock: writers make `_version` odd while they 
+ * update the index, and a query retries if the version changed while it 
+ * read. Memory a query may read is not freed before the graph is.
  */	
 class TaskDepGraph {
     
 public:
-  TaskDepGraph() {}
-  ~TaskDepGraph(){}
-  void addDeps(const ompt_dependence_t& dependence, void* taskPtr);
-  bool hasPath(void* from, void* to);
+  TaskDepGraph();
+  ~TaskDepGraph();
+  void addDeps(const ompt_dependence_t* deps, int ndeps, TaskData* taskData);
+  bool hasPath(int from, int to);
 private:
-  void addEdge(void* from, void* to);
-  std::unordered_map<void*, 
-	  std::vector<std::pair<void*, ompt_dependence_type_t>>> _deps;
-  std::unordered_map<void*, std::vector<void*>> _graph;
+  void addEdge(int from, int to);
+  void _advanceFrontier(DepFrontier& frontier, 
+          ompt_dependence_type_t depType, int curTaskId, 
+          std::vector<std::pair<int, int>>& edges);
+  DepFrontier& _getFrontier(DepShard& shard, int parentId, void* variable);
+  bool _hasPath(int from, int to);
+  DepNode* _findNode(int id);
+  DepNode& _getNode(int id);
+  void _assignChain(DepNode& node, int id);
+  void _setAncestors(DepNode& node, 
+          const std::vector<std::pair<int, int>>& ancestors);
+  void _mergeAncestors(int id, const std::vector<std::pair<int, int>>& more);
+  DepShard _shards[DEP_GRAPH_SHARDS];
+  McsLock _indexLock; // serializes writers of the index
+  std::atomic<uint64_t> _version; // odd while the index is being updated
+  std::atomic<DepNode*> _nodeChunks[DEP_NODE_NUM_CHUNKS]; // by task local id
+  std::vector<int> _chainTails; // last node of each chain
+  std::vector<AncestorList*> _retiredLists; // outgrown ancestor lists
 };
 
 }
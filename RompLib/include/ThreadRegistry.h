@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+
+namespace romp {
+
+/*
+ * ThreadRegistry gives each thread an entry of type T of its own, such as a
+ * per-thread cache or statistics counters, and links the entries of all
+ * threads in a list so that they can be visited, e.g. to sum up statistics
+ * at finalization. T has a `next` pointer for the list. Entries are never
+ * freed, and the registry has no destructor because the tool is finalized
+ * after static destructors have run. There is one registry per type T.
+ */
+template<typename T>
+class ThreadRegistry {
+
+public:
+  constexpr ThreadRegistry(): _head(nullptr) {}
+  T* getThreadEntry();
+  T* findThreadEntry() const;
+  template<typename F>
+  void forEach(F visit) const;
+private:
+  std::atomic<T*> _head;
+  static thread_local T* _threadEntry;
+};
+
+template<typename T>
+thread_local T* ThreadRegistry<T>::_threadEntry = nullptr;
+
+/*
+ * Return the entry of the calling thread, create and register it upon the
+ * first call of the thread.
+ */
+template<typename T>
+T* ThreadRegistry<T>::getThreadEntry() {
+  if (!_threadEntry) {
+    auto entry = new T();
+    entry->next = _head.load(std::memory_order_relaxed);
+    while (!_head.compare_exchange_weak(entry->next, entry,
+                std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    _threadEntry = entry;
+  }
+  return _threadEntry;
+}
+
+/*
+ * Return the entry of the calling thread, nullptr if it has none yet.
+ */
+template<typename T>
+T* ThreadRegistry<T>::findThreadEntry() const {
+  return _threadEntry;
+}
+
+/*
+ * Call `visit` on the entry of every thread. Entries are still updated by
+ * their threads, the caller makes sure that no thread does so meanwhile if
+ * it needs exact values.
+ */
+template<typename T>
+template<typename F>
+void ThreadRegistry<T>::forEach(F visit) const {
+  auto entry = _head.load(std::memory_order_acquire);
+  while (entry) {
+    visit(*entry);
+    entry = entry->next;
+  }
+}
+
+}
@@ -0,0 +1,136 @@
+#include "AccessDedup.h"
+
+#include <cstring>
+
+#include "InternTable.h"
+#include "ThreadRegistry.h"
+
+namespace romp {
+
+/*
+ * Between two synchronization points the label and the lock set of a task do
+ * not change. A repeated access to a granule in such an interval can not find
+ * a data race or leave information that the first access did not, provided
+ * the first access was at least as strong. The dedup set remembers the bytes
+ * accessed in the current interval. The interval is identified by the label,
+ * the lock set and the reduction state of the current task, and the set is
+ * cleared when any of them changes, or when the thread recycles memory. 
+ * Clearing only advances the stamp. The set holds a reference on the label
+ * entry it is keyed on, so that the label id is not reused by another task
+ * while the set remembers accesses made with it.
+ */
+typedef struct DedupSet {
+  DedupEntry entries[DEDUP_SET_SIZE];
+  uint32_t stamp;
+  uint32_t labelId;
+  uint32_t lockSetId;
+  bool inReduction;
+  uint64_t hits;
+  uint64_t misses;
+  DedupSet* next;
+  // stamp 0 is never used, so that zeroed entries are empty
+  DedupSet(): entries(), stamp(1), labelId(0), lockSetId(0), 
+      inReduction(false), hits(0), misses(0), next(nullptr) {}
+} DedupSet;
+
+ThreadRegistry<DedupSet> gDedupSets;
+
+static void clearDedupSet(DedupSet* set) {
+  set->stamp++;
+  if (set->stamp == 0) {
+    // stamp wrapped around, stale entries could look valid again
+    memset(set->entries, 0, sizeof(set->entries));
+    set->stamp = 1;
+  }
+}
+
+static uint64_t hashGranule(uint64_t granule) {
+  return (granule * 0x9e3779b97f4a7c15) >> (64 - DEDUP_SET_BITS);
+}
+
+/*
+ * Return true if the access to bytes `byteMask` of the shadow granule
+ * starting at `granule` is covered by earlier accesses of the current
+ * interval: a read is covered by reads or writes, a write only by writes.
+ * Otherwise record the access and return false, the caller checks it.
+ */
+bool accessIsDuplicate(uint64_t granule,
+                       uint8_t byteMask,
+                       bool isWrite,
+                       uint32_t labelId,
+                       uint32_t lockSetId,
+                       bool inReduction) {
+  auto set = gDedupSets.getThreadEntry();
+  if (set->labelId != labelId || set->lockSetId != lockSetId ||
+      set->inReduction != inReduction) {
+    clearDedupSet(set);
+    if (set->labelId != labelId) {
+      retainLabelEntry(labelId);
+      releaseLabelEntry(set->labelId);
+    }
+    set->labelId = labelId;
+    set->lockSetId = lockSetId;
+    set->inReduction = inReduction;
+  }
+  auto index = hashGranule(granule);
+  for (int i = 0; i < DEDUP_MAX_PROBES; ++i) {
+    auto& entry = set->entries[(index + i) & (DEDUP_SET_SIZE - 1)];
+    if (entry.stamp != set->stamp) {
+      // empty entry, the granule is not in the set
+      entry.granule = granule;
+      entry.stamp = set->stamp;
+      entry.readMask = isWrite ? 0 : byteMask;
+      entry.writeMask = isWrite ? byteMask : 0;
+      set->misses++;
+      return false;
+    }
+    if (entry.granule == granule) {
+      auto coveredMask = isWrite ? entry.writeMask :
+          static_cast<uint8_t>(entry.readMask | entry.writeMask);
+      if ((byteMask & ~coveredMask) == 0) {
+        set->hits++;
+        return true;
+      }
+      if (isWrite) {
+        entry.writeMask |= byteMask;
+      } else {
+        entry.readMask |= byteMask;
+      }
+      set->misses++;
+      return false;
+    }
+  }
+  // the probe sequence is full, check the access without recording it
+  set->misses++;
+  return false;
+}
+
+/*
+ * Called when the thread recycles the memory of a task that completes or is
+ * switched out on it. The history of the memory is reset, so an access that
+ * was checked before has to be checked again. The memory was in use by the
+ * task on this thread, so only the set of this thread is cleared. Another
+ * thread that accessed the memory in its current interval checks it again
+ * once the interval ends.
+ */
+void clearThreadDedupSet() {
+  auto set = gDedupSets.findThreadEntry();
+  if (set) {
+    clearDedupSet(set);
+  }
+}
+
+/*
+ * Sum up the dedup statistics of all threads. Called at finalization when
+ * no thread is checking accesses any more.
+ */
+void getAccessDedupStats(uint64_t& hits, uint64_t& misses) {
+  hits = 0;
+  misses = 0;
+  gDedupSets.forEach([&](const DedupSet& set) {
+    hits += set.hits;
+    misses += set.misses;
+  });
+}
+
+}
@@ -0,0 +1,72 @@
+#include "AccessFilter.h"
+
+#include "ThreadRegistry.h"
+
+namespace romp {
+
+typedef struct AccessFilterStats {
+  uint64_t numChecked;
+  uint64_t numFiltered[eNumAccessFilters];
+  AccessFilterStats* next;
+} AccessFilterStats;
+
+ThreadRegistry<AccessFilterStats> gAccessFilterStats;
+
+static bool rejectAccess(AccessFilterStats* stats, AccessFilterType filter) {
+  stats->numFiltered[filter]++;
+  return true;
+}
+
+/*
+ * Return true if the access is rejected by one of the filters and does not
+ * need data race checking. Accesses protected by hardware lock are atomic.
+ * Accesses to the stack frames below the task's exit frame and to static
+ * thread local storage are private to the thread.
+ */
+bool filterAccess(bool hwLock, DataSharingType dataSharingType) {
+  auto stats = gAccessFilterStats.getThreadEntry();
+  if (hwLock) {
+    return rejectAccess(stats, eFilterHwLock);
+  }
+  if (dataSharingType == eThreadPrivateBelowExit) {
+    return rejectAccess(stats, eFilterThreadPrivateBelowExit);
+  }
+  if (dataSharingType == eStaticThreadPrivate) {
+    return rejectAccess(stats, eFilterStaticThreadPrivate);
+  }
+  stats->numChecked++;
+  return false;
+}
+
+/*
+ * Sum up the filter statistics of all threads. Called at finalization when
+ * no thread is checking accesses any more.
+ */
+void getAccessFilterStats(uint64_t& numChecked,
+                          uint64_t numFiltered[eNumAccessFilters]) {
+  numChecked = 0;
+  for (int i = 0; i < eNumAccessFilters; ++i) {
+    numFiltered[i] = 0;
+  }
+  gAccessFilterStats.forEach([&](const AccessFilterStats& stats) {
+    numChecked += stats.numChecked;
+    for (int i = 0; i < eNumAccessFilters; ++i) {
+      numFiltered[i] += stats.numFiltered[i];
+    }
+  });
+}
+
+const char* getAccessFilterName(int filter) {
+  switch(filter) {
+    case eFilterHwLock:
+      return "hardware lock";
+    case eFilterThreadPrivateBelowExit:
+      return "thread private below exit";
+    case eFilterStaticThreadPrivate:
+      return "static thread private";
+    default:
+      return "unknown";
+  }
+}
+
+}
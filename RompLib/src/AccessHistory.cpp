@@ -2,51 +2,151 @@
 
 #include <glog/logging.h>
 #include <glog/raw_logging.h>
+#include <sched.h>
 
 namespace romp {
 
-void AccessHistory::_initRecords() {
-  _records = std::make_unique<std::vector<Record>>();
+/*
+ * Return the pointer to the records storage. The storage is valid in its
+ * zero-initialized state, so no lazy initialization is needed.
+ * We assume the access history is under mutual exclusion.
+ */
+RecordStorage* AccessHistory::getRecords() {
+  return &_records;
 }
 
-McsLock& AccessHistory::getLock() {
-  return _lock;
+const RecordStorage* AccessHistory::getRecords() const {
+  return &_records;
 }
 
 /*
- * If records pointer has not been initialized, initialize the record first.
- * Then return the raw pointer to the records vector.
- * We assume the access history is under mutual exclusion.
+ * Bits of the sync word other than the spin bit are only modified by the 
+ * writer holding the spin bit, so a plain store does not lose any update.
  */
-std::vector<Record>* AccessHistory::getRecords() {
-  if (!_records.get()) {
-    _initRecords();
-  }
-  return _records.get();
+void AccessHistory::_setSyncBits(uint32_t bits) {
+  auto sync = _sync.load(std::memory_order_relaxed);
+  _sync.store(sync | bits, std::memory_order_relaxed);
+}
+
+void AccessHistory::_clearSyncBits(uint32_t bits) {
+  auto sync = _sync.load(std::memory_order_relaxed);
+  _sync.store(sync & ~bits, std::memory_order_relaxed);
 }
 
 void AccessHistory::setFlag(AccessHistoryFlag flag) {
-  _state |= flag;
+  _setSyncBits(static_cast<uint32_t>(flag) << FLAG_SHIFT);
 }
 
 void AccessHistory::clearFlag(AccessHistoryFlag flag) {
-  _state &= ~flag; 
+  _clearSyncBits(static_cast<uint32_t>(flag) << FLAG_SHIFT);
 }
 
+/*
+ * Clear all flags and the data race mask. The generation is kept.
+ */
 void AccessHistory::clearFlags() {
-  _state = 0; 
+  _clearSyncBits((1u << VERSION_SHIFT) - 1 - SYNC_LOCK_BIT);
 }
 
 bool AccessHistory::dataRaceFound() const {
-  return (_state & eDataRaceFound) != 0;
+  auto sync = _sync.load(std::memory_order_relaxed);
+  return (sync & (eDataRaceFound << FLAG_SHIFT)) != 0;
 }
 
 bool AccessHistory::memIsRecycled() const {
-  return (_state & eMemoryRecycled) != 0;
+  auto sync = _sync.load(std::memory_order_relaxed);
+  return (sync & (eMemoryRecycled << FLAG_SHIFT)) != 0;
+}
+
+/*
+ * Mark bytes in `byteMask` as having a reported data race. Later accesses 
+ * to these bytes are not checked any more.
+ */
+void AccessHistory::setDataRaceMask(uint8_t byteMask) {
+  _setSyncBits((eDataRaceFound << FLAG_SHIFT) | 
+          (static_cast<uint32_t>(byteMask) << DATA_RACE_MASK_SHIFT));
+}
+
+uint8_t AccessHistory::getDataRaceMask() const {
+  auto sync = _sync.load(std::memory_order_relaxed);
+  return static_cast<uint8_t>(sync >> DATA_RACE_MASK_SHIFT);
+}
+
+void AccessHistory::setGeneration(uint32_t generation) {
+  _generation = generation;
+}
+
+uint32_t AccessHistory::getGeneration() const {
+  return _generation;
+}
+
+/*
+ * An access history is exclusive to an ownership epoch of a task if all its
+ * records are made in that epoch. The owner is 0 if the history is empty or
+ * shared by several epochs.
+ */
+uint32_t AccessHistory::getOwner() const {
+  return _owner;
+}
+
+void AccessHistory::setOwner(uint32_t ownerId) {
+  _owner = ownerId;
+}
+
+/*
+ * The access history is protected by the spin bit of its sync word. The 
+ * critical sections are short, so a writer spins on the word and yields the
+ * processor only after HISTORY_SPIN_LIMIT attempts, in case the holder has 
+ * been preempted. lock() and unlock() are called by HistoryWriteGuard only.
+ */
+void AccessHistory::lock() {
+  auto numSpins = 0;
+  auto sync = _sync.load(std::memory_order_relaxed);
+  while (true) {
+    if ((sync & SYNC_LOCK_BIT) == 0 && 
+        _sync.compare_exchange_weak(sync, sync | SYNC_LOCK_BIT,
+            std::memory_order_acquire, std::memory_order_relaxed)) {
+      // order the spin bit before the modifications for optimistic readers
+      std::atomic_thread_fence(std::memory_order_release);
+      return;
+    }
+    if (++numSpins == HISTORY_SPIN_LIMIT) {
+      sched_yield();
+      numSpins = 0;
+    }
+    sync = _sync.load(std::memory_order_relaxed);
+  }
 }
 
-uint64_t AccessHistory::getState() const {
-  return _state;
+/*
+ * Release the spin bit and advance the version in one store. The version 
+ * wraps around silently, an optimistic reader would have to stall for 2^21 
+ * modifications of the same history to miss one.
+ */
+void AccessHistory::unlock() {
+  auto sync = _sync.load(std::memory_order_relaxed);
+  sync = (sync & ~SYNC_LOCK_BIT) + (1u << VERSION_SHIFT);
+  _sync.store(sync, std::memory_order_release);
+}
+
+/*
+ * Start reading the access history without holding the lock. Return the 
+ * sync word to validate the read against. A set spin bit means that a writer
+ * is modifying the history and the read is bound to fail.
+ */
+uint32_t AccessHistory::beginOptimisticRead() const {
+  return _sync.load(std::memory_order_acquire);
+}
+
+/*
+ * Return true if the access history has not been modified since 
+ * beginOptimisticRead() returned `version`, so that everything read in 
+ * between forms a consistent snapshot.
+ */
+bool AccessHistory::validateOptimisticRead(uint32_t version) const {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return (version & SYNC_LOCK_BIT) == 0 && 
+      _sync.load(std::memory_order_relaxed) == version;
 }
 
 }
@@ -5,16 +5,29 @@
 
 #include "AccessHistory.h"
 #include "DataSharing.h"
+#include "HappensBeforeCache.h"
+#include "InternTable.h"
 #include "Label.h"
 #include "ParRegionData.h"
 #include "QueryFuncs.h"
 #include "ShadowMemory.h"
+#include "SlabAllocator.h"
+#include "TaskContext.h"
 #include "TaskData.h"
 #include "ThreadData.h"
 
 namespace romp {   
 
-extern ShadowMemory<AccessHistory> shadowMemory;
+extern RompShadowMemory<AccessHistory> shadowMemory;
+extern uint32_t gShadowIdleEpochs;
+
+/*
+ * Number of outermost parallel regions that are active. Initial threads 
+ * created by the application may run outermost regions concurrently, the
+ * access history is only pruned when none of them is active.
+ */
+McsLock gOutermostRegionLock;
+int gNumActiveOutermostRegions = 0;
    
 void on_ompt_callback_implicit_task(
        ompt_scope_endpoint_t endPoint,
@@ -25,9 +38,12 @@ void on_ompt_callback_implicit_task(
        int flags) {
   RAW_DLOG(INFO, "on_ompt_callback_implicit_task called:%u p:%lx t:%lx %u %u %d",
           endPoint, parallelData, taskData, actualParallelism, index, flags);
+  // the thread begins or ends executing the implicit task
+  invalidateTaskContext();
   if (flags == ompt_task_initial) {
     RAW_DLOG(INFO, "generating initial task: %lx", taskData);
-    auto initTaskData = new TaskData();
+    auto initTaskData = slabNew<TaskData>();
+    initTaskData->expLocalId = -1;
     auto newTaskLabel = genInitTaskLabel();
     initTaskData->label = std::move(newTaskLabel);
     taskData->ptr = static_cast<void*>(initTaskData);
@@ -45,7 +61,7 @@ void on_ompt_callback_implicit_task(
     if (!taskDataPtr) {
       RAW_LOG(FATAL, "task data pointer is null");
     }
-    delete taskDataPtr; 
+    releaseTaskData(taskDataPtr); 
     taskData->ptr = nullptr;
     return;
   }
@@ -61,12 +77,18 @@ void on_ompt_callback_implicit_task(
     auto newTaskLabel = genImpTaskLabel((parentTaskData->label).get(), index, 
             actualParallelism); 
     // return value optimization should avoid the ref count mod
-    auto newTaskDataPtr = new TaskData();
+    auto newTaskDataPtr = slabNew<TaskData>();
     RAW_DLOG(INFO, "created task data ptr: %p stored at %p",
             newTaskDataPtr, taskData);
     // cast to rvalue and avoid atomic ref count modification
     newTaskDataPtr->label = std::move(newTaskLabel); 
     RAW_DLOG(INFO, "%p label is: %p", newTaskDataPtr, newTaskDataPtr->label.get());
+    auto parRegionData = static_cast<ParRegionData*>(parallelData->ptr);
+    if (parRegionData) {
+      newTaskDataPtr->teamId = parRegionData->teamId;
+    }
+    // implicit tasks get negative local ids, distinct from explicit ones
+    newTaskDataPtr->expLocalId = -1 - static_cast<int>(index);
     taskData->ptr = static_cast<void*>(newTaskDataPtr);
   } else if (endPoint == ompt_scope_end) {
     /* 
@@ -85,7 +107,7 @@ void on_ompt_callback_implicit_task(
     auto mutatedLabel = mutateParentImpEnd(taskDataPtr->label.get());
     parentTaskData->label = std::move(mutatedLabel);
     RAW_DLOG(INFO, "modifying parent label: %p %p", parentTaskData);
-    delete taskDataPtr; 
+    releaseTaskData(taskDataPtr); 
     taskData->ptr = nullptr;
   }
 }
@@ -99,6 +121,17 @@ inline Segment* getLastSegment(Label* label) {
   return label->getKthSegment(lenLabel - 1);
 }
 
+/*
+ * Helper function for getting the key of the taskgroup the task with label
+ * `label` is in, used to bucket the explicit children of the task.
+ */
+inline uint64_t getTaskGroupKey(Label* label) {
+  auto seg = getLastSegment(label);
+  return (static_cast<uint64_t>(label->getLabelLength()) << 32) |
+      (static_cast<uint64_t>(seg->getTaskGroupId()) << 16) | 
+      seg->getTaskGroupLevel();
+}
+
 /*
  * Once a task encounters a taskwait, mark the task's explicit children to 
  * be taskwaited, and record the ordered section phase value 
@@ -106,47 +139,46 @@ inline Segment* getLastSegment(Label* label) {
 void markExpChildSyncTaskwait(TaskData* taskData, Label* curLabel) {
   auto seg = getLastSegment(curLabel);
   auto phase = seg->getPhase();
-  for (const auto& child : taskData->childExpTaskData) {
-    auto childTaskData = static_cast<const TaskData*>(child); 
-    auto lenLabel = childTaskData->label->getLabelLength(); 
-    auto lastSeg = childTaskData->label->getKthSegment(lenLabel - 1);
-    lastSeg->setTaskwaited();
-    lastSeg->setTaskwaitPhase(phase);
-  }
-  taskData->childExpTaskData.clear(); // clear the children after taskwait
+  auto& buckets = taskData->childExpTaskBuckets;
+  if (buckets.empty()) {
+    return;
+  }
+  for (const auto& bucket : buckets) {
+    for (const auto& child : bucket.children) {
+      auto childTaskData = static_cast<TaskData*>(child); 
+      auto lastSeg = getLastSegment(childTaskData->label.get());
+      lastSeg->setTaskwaited();
+      lastSeg->setTaskwaitPhase(phase);
+      releaseTaskData(childTaskData);
+    }
+  }
+  // cached concurrent results may be ordered by the new sync marks
+  advanceSyncEpoch();
+  buckets.clear(); // clear the children after taskwait
 }
 
 /*
  * Once a task encounters the end of taskgroup, mark all explicit task 
- * children which are inside the ending taskgroup. 
+ * children which are inside the ending taskgroup. Those are the children 
+ * created with the same label length and taskgroup as the current label, 
+ * found in one bucket. Children created in a nested construct have longer 
+ * labels and are not inside current task group.
  */
 void markExpChildSyncTaskGroupEnd(TaskData* taskData, Label* curLabel) {
-  auto seg = getLastSegment(curLabel);
-  auto phase = seg->getPhase();
-  auto taskGroupLevel = seg->getTaskGroupLevel();
-  auto taskGroupId = seg->getTaskGroupId(); 
-  auto it = taskData->childExpTaskData.begin();
-  auto lenParentLabel = curLabel->getLabelLength();
-  while (it != taskData->childExpTaskData.end()) {
-    auto childTaskData = static_cast<TaskData*>(*it);
-    auto childLabel = childTaskData->label;
-    auto lenChildLabel = childLabel->getLabelLength();
-    if (lenChildLabel > lenParentLabel) {
-      // This child task is not inside current task group
-      it++; 
-    } else {
-      auto lastSeg = childLabel->getLastKthSegment(1);    
-      // check if the task group id matches  
-      auto childTaskGroupId = lastSeg->getTaskGroupId();
-      if (childTaskGroupId == taskGroupId) {
-        auto mutatedChildLabel = mutateTaskGroupSyncChild(childLabel.get());
-        childTaskData->label = std::move(mutatedChildLabel);
-        it = taskData->childExpTaskData.erase(it);
-      } else {
-        it++;
-      }
-    }
+  auto bucket = findExpChildBucket(taskData, getTaskGroupKey(curLabel));
+  if (!bucket) {
+    return;
   }
+  for (const auto& child : bucket->children) {
+    auto childTaskData = static_cast<TaskData*>(child);
+    auto mutatedChildLabel = mutateTaskGroupSyncChild(
+            childTaskData->label.get());
+    childTaskData->label = std::move(mutatedChildLabel);
+    releaseTaskData(childTaskData);
+  }
+  advanceSyncEpoch();
+  auto& buckets = taskData->childExpTaskBuckets;
+  buckets.erase(buckets.begin() + (bucket - buckets.data()));
 }
 
 void on_ompt_callback_sync_region(
@@ -191,6 +223,7 @@ void on_ompt_callback_sync_region(
       case ompt_sync_region_barrier_implementation:
       case ompt_sync_region_barrier_implicit:
         mutatedLabel = mutateBarrierEnd(labelPtr);
+        taskDataPtr->barrierEpoch++;
         break;
       case ompt_sync_region_reduction:
         taskDataPtr->inReduction = false;
@@ -224,16 +257,8 @@ void on_ompt_callback_mutex_acquired(
     mutatedLabel = mutateOrderSection(label.get()); 
   } else {
     RAW_DLOG(INFO, "mutex acquired on wait id: %lu", waitId);
-    if (taskDataPtr->lockSet == nullptr) {
-      auto lockSet = std::make_shared<SmallLockSet>();
-      taskDataPtr->lockSet = std::move(lockSet);
-      taskDataPtr->lockSet->addLock(static_cast<uint64_t>(waitId));
-    } else {
-      // we need to clone the old lockset before modifying it
-      auto clonedLockSet = taskDataPtr->lockSet->clone();
-      clonedLockSet->addLock(static_cast<uint64_t>(waitId));
-      taskDataPtr->lockSet = std::move(clonedLockSet);
-    }
+    taskDataPtr->lockSet = getLockSetAfterAcquire(taskDataPtr->lockSet, 
+            static_cast<uint64_t>(waitId));
   }
   if (mutatedLabel) {
     taskDataPtr->label = std::move(mutatedLabel);
@@ -257,10 +282,8 @@ void on_ompt_callback_mutex_released(
   if (kind == ompt_mutex_ordered) {
     mutatedLabel = mutateOrderSection(label.get());
   } else {
-    // we need to clone the old lockset before modifying it
-    auto clonedLockSet = taskDataPtr->lockSet->clone();
-    clonedLockSet->removeLock(waitId);
-    taskDataPtr->lockSet = std::move(clonedLockSet);
+    taskDataPtr->lockSet = getLockSetAfterRelease(taskDataPtr->lockSet, 
+            static_cast<uint64_t>(waitId));
   }
   if (mutatedLabel) {
     taskDataPtr->label = std::move(mutatedLabel);
@@ -414,6 +437,8 @@ void on_ompt_callback_work(
       break;
   }
   taskDataPtr->label = std::move(mutatedLabel);
+  // labels on different sides of a workshare boundary may be concurrent
+  resetTaskOwnerId(taskDataPtr);
 }
 
 void on_ompt_callback_parallel_begin(
@@ -425,8 +450,18 @@ void on_ompt_callback_parallel_begin(
        const void *codePtrRa) {
   RAW_DLOG(INFO, "parallel begin et:%lx p:%lx %u %d", encounteringTaskData, 
            parallelData, requestedParallelism, flags);
-  auto parRegionData = new ParRegionData(requestedParallelism, flags);
+  auto parRegionData = slabNew<ParRegionData>(requestedParallelism, 
+          flags);
   parallelData->ptr = static_cast<void*>(parRegionData);  
+  int taskType, threadNum;
+  void* dataPtr;
+  if (queryTaskInfo(0, taskType, threadNum, dataPtr) && 
+      (taskType & ompt_task_initial)) {
+    parRegionData->isOutermost = true;
+    McsNode node;
+    LockGuard guard(&gOutermostRegionLock, &node);
+    gNumActiveOutermostRegions++;
+  }
 }
 
 void on_ompt_callback_parallel_end( 
@@ -439,8 +474,31 @@ void on_ompt_callback_parallel_end(
 		  parallelData,
 		  parallelData->ptr,
                   flags);
-  auto parRegionData = parallelData->ptr;
-  delete static_cast<ParRegionData*>(parRegionData);
+  auto parRegionData = static_cast<ParRegionData*>(parallelData->ptr);
+  if (parRegionData->isOutermost) {
+    /*
+     * Every access recorded so far happens before any access to come once
+     * the last active outermost region ends. The lock keeps new outermost
+     * regions from starting while the history is pruned.
+     */
+    McsNode node;
+    LockGuard guard(&gOutermostRegionLock, &node);
+    gNumActiveOutermostRegions--;
+    if (gNumActiveOutermostRegions == 0) {
+      shadowMemory.pruneHistory(gShadowIdleEpochs, 
+              [](AccessHistory* accessHistory, bool isInvalidated) {
+        // same as the reset upon next access in checkDataRace
+        if (isInvalidated) {
+          accessHistory->clearFlags();
+        }
+        accessHistory->setGeneration(0);
+        accessHistory->getRecords()->clear();
+      });
+    }
+  }
+  slabDelete(parRegionData);
+  // the thread resumes the encountering task
+  invalidateTaskContext();
 }  
 
 void on_ompt_callback_task_create(
@@ -450,7 +508,7 @@ void on_ompt_callback_task_create(
         int flags,
         int hasDependences,
         const void *codePtrRa) {
-  auto taskData = new TaskData();
+  auto taskData = slabNew<TaskData>();
   if (flags == ompt_task_initial) {
     /*
      * In recent diff (merged from https://reviews.llvm.org/D68615),initial task
@@ -471,9 +529,18 @@ void on_ompt_callback_task_create(
     auto newTaskLabel = genExpTaskLabel(parentLabel);
     taskData->label = std::move(newTaskLabel);
     taskData->isExplicitTask = true; // mark current task as explicit task
+    /*
+     * The explicit task completes by the next barrier of the team, so it
+     * runs in the barrier epoch in which it is created.
+     */
+    taskData->teamId = parentTaskData->teamId;
+    taskData->barrierEpoch = parentTaskData->barrierEpoch;
+    // dependences only order tasks with the same parent
+    taskData->parentLocalId = parentTaskData->expLocalId;
+    // held by the parent until it syncs the child
+    addExpChildTask(parentTaskData, taskData, getTaskGroupKey(parentLabel));
     auto mutatedParentLabel = mutateParentTaskCreate(parentLabel); 
     parentTaskData->label = std::move(mutatedParentLabel);
-    parentTaskData->childExpTaskData.push_back(static_cast<void*>(taskData));
     // get parallel region info, atomic fetch and add the explicit task id
     auto teamSize = 0;
     void* parallelDataPtr = nullptr;   
@@ -510,6 +577,7 @@ void on_ompt_callback_task_schedule(
         ompt_task_status_t priorTaskStatus,
         ompt_data_t *nextTaskData) {
   RAW_DLOG(INFO, "ompt_callback_task_schedule"); 
+  invalidateTaskContext();
   auto taskPtr = priorTaskData->ptr;
   if (!taskPtr) {
     RAW_LOG(FATAL, "prior task data pointer is null"); 
@@ -520,6 +588,10 @@ void on_ompt_callback_task_schedule(
       handleTaskComplete(taskPtr);
       recycleTaskThreadStackMemory(taskPtr);
       recycleTaskPrivateMemory();
+      if (static_cast<TaskData*>(taskPtr)->isExplicitTask) {
+        releaseTaskData(static_cast<TaskData*>(taskPtr));
+        priorTaskData->ptr = nullptr;
+      }
       break;
     case ompt_task_yield:
       RAW_DLOG(INFO, "taskyield construct encountered");
@@ -566,14 +638,8 @@ void on_ompt_callback_dependences(
     RAW_LOG(WARNING, "callback dependences: current task data ptr is null");
     return;
   }
-  McsNode node;      
-  LockGuard guard(&(parallelData->lock), &node);
-  // while in mutual exculsion, maintain explicit task dependencies
-  for (int i = 0; i < ndeps; ++i) {
-    auto variable = deps[i].variable; 
-    auto depType = deps[i].dependence_type;
-    maintainTaskDeps(deps[i], taskPtr, parallelData);
-  }
+  // tasks with dependences on different variables register concurrently
+  maintainTaskDeps(deps, ndeps, taskPtr, parallelData);
 }
 
 
@@ -590,6 +656,7 @@ void on_ompt_callback_thread_begin(
     return;
   }
   threadData->ptr = static_cast<void*>(newThreadData);
+  invalidateTaskContext();
   void* stackAddr = nullptr;
   uint64_t stackSize = 0;
   if (!queryThreadStackInfo(stackAddr, stackSize)) {
@@ -613,6 +680,7 @@ void on_ompt_callback_thread_end(
     delete static_cast<ThreadData*>(dataPtr);
   }
   threadData->ptr = nullptr;
+  invalidateTaskContext();
 }
 
 void on_ompt_callback_dispatch(
@@ -627,6 +695,8 @@ void on_ompt_callback_dispatch(
   auto taskDataPtr = static_cast<TaskData*>(taskData->ptr);
   auto parentLabel = (taskDataPtr->label).get();
   std::shared_ptr<Label> mutatedLabel = nullptr;
+  // each dispatched chunk or section is a new logical task
+  resetTaskOwnerId(taskDataPtr);
   if (kind == ompt_dispatch_iteration) {
     mutatedLabel = mutateIterDispatch(parentLabel, instance.value);
   } else if (kind == ompt_dispatch_section) {
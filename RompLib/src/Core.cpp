@@ -3,8 +3,10 @@
 #include <glog/logging.h>
 #include <glog/raw_logging.h>
 
+#include "HappensBeforeCache.h"
+#include "InternTable.h"
 #include "ParRegionData.h"
-#include "QueryFuncs.h"
+#include "TaskContext.h"
 
 namespace romp {
 /*
@@ -27,6 +29,10 @@ namespace romp {
  */
 bool analyzeRaceCondition(const Record& histRecord, const Record& curRecord, 
         bool& isHistBeforeCur, int& diffIndex) {
+  if (histRecord.isReadSummary()) {
+    return analyzeReadSummary(histRecord, curRecord, isHistBeforeCur, 
+            diffIndex);
+  }
   auto histLabel = histRecord.getLabel(); 
   auto curLabel = curRecord.getLabel(); 
   if (analyzeMutualExclusion(histRecord, curRecord)) {
@@ -38,24 +44,25 @@ bool analyzeRaceCondition(const Record& histRecord, const Record& curRecord,
     // that in this phase no data race is genereted by reduction method.
     return false;
   }
-  isHistBeforeCur = happensBefore(histLabel, curLabel, diffIndex);
+  isHistBeforeCur = happensBeforeCached(histLabel, curLabel, diffIndex);
   if (!isHistBeforeCur) {
     // further check explicit task dependence if current task and history task 
-    // are both explicit tasks. If no task dependence, return true
-    auto histTaskData = static_cast<TaskData*>(histRecord.getTaskPtr()); 
-    if (curTaskData->isExplicitTask && histTaskData->isExplicitTask) {
-      // have to get the associated parallel region
-      auto teamSize = 0;
-      void* parallelDataPtr = nullptr;
-      if (!queryParallelInfo(0, teamSize, parallelDataPtr)) {
+    // are both explicit tasks. If no task dependence, return true. The 
+    // history task may have completed, its label entry tells about it.
+    const auto& histEntry = getInternedLabelEntry(histRecord.getLabelId());
+    if (curTaskData->isExplicitTask && histEntry.isExplicitTask) {
+      // the associated parallel region is cached in the current task context
+      auto parallelDataPtr = tTaskContext.parRegionData;
+      if (!parallelDataPtr) {
         RAW_LOG(WARNING, "cannot get parallel region data");
       } else {
         auto parallelData = static_cast<ParRegionData*>(parallelDataPtr); 
-        // have to lock the task dep graph before graph traversal
-	McsNode node;
-	LockGuard guard(&(parallelData->lock), &node);
-        if (parallelData->taskDepGraph.hasPath((void*)histTaskData, 
-				 (void*)curTaskData)) {
+        auto taskDepGraph = parallelData->taskDepGraph.load(
+                std::memory_order_acquire);
+        // local ids are only meaningful among tasks of the same region
+        if (taskDepGraph && histEntry.teamId == parallelData->teamId &&
+            taskDepGraph->hasPath(histEntry.expLocalId, 
+                                  curTaskData->expLocalId)) {
           isHistBeforeCur = true;
 	}
       }
@@ -80,6 +87,66 @@ bool analyzeMutualExclusion(const Record& histRecord, const Record& curRecord) {
 }
 
 
+/*
+ * Return true if the record is a read by an implicit task of a team outside 
+ * of any workshare construct and explicit task, without lock. Such reads of 
+ * different implicit tasks in the same barrier epoch can be summarized. The 
+ * thread number of the reader is returned in `threadNum`.
+ */
+static bool isSummarizableRead(const Record& record, uint64_t& threadNum) {
+  if (record.isWrite() || record.hasHwLock() || record.isReadSummary() ||
+      record.getLockSetId() != NULL_INTERN_ID) {
+    return false;
+  }
+  auto label = record.getLabel();
+  auto leafSegment = label->getKthSegment(label->getLabelLength() - 1);
+  if (leafSegment->getType() != eImplicit) {
+    return false;
+  }
+  uint64_t offset, span;
+  leafSegment->getOffsetSpan(offset, span);
+  if (span <= 1) {
+    return false;
+  }
+  threadNum = offset % span;
+  return true;
+}
+
+/*
+ * This function analyzes race condition between the reads summarized in
+ * `summary` and the current access. The summarized reads are made by at 
+ * least READ_SUMMARY_THRESHOLD implicit tasks T(L_i) of a team between two 
+ * barriers, so their labels share all segments but the leaf implicit 
+ * segment, denote its index as k. Compare the current label with the label 
+ * of the representative reader:
+ * 1. labels differ before index k. All T(L_i) relate to T(curLabel) in the
+ *    same way as the representative reader does.
+ * 2. otherwise, T(curLabel) is a descendent of an implicit task of the same 
+ *    team in the same barrier epoch. T(curLabel) is logically concurrent 
+ *    with the reads of all other implicit tasks, there is at least one.
+ * `isSummaryBeforeCur` is set only if all summarized reads happen before the
+ * current access. Return true if there is race condition.
+ */
+bool analyzeReadSummary(const Record& summary, const Record& curRecord, 
+                        bool& isSummaryBeforeCur, int& diffIndex) {
+  auto histLabel = summary.getLabel();
+  auto curLabel = curRecord.getLabel();
+  auto curTaskData = static_cast<TaskData*>(curRecord.getTaskPtr());
+  if (curTaskData->inReduction) {
+    isSummaryBeforeCur = false;
+    return false;
+  }
+  auto leafIndex = histLabel->getLabelLength() - 1;
+  diffIndex = compareLabels(histLabel, curLabel);
+  if ((diffIndex >= 0 && diffIndex < leafIndex) || 
+      diffIndex == static_cast<int>(eRightIsPrefix)) {
+    isSummaryBeforeCur = happensBeforeCached(histLabel, curLabel, diffIndex);
+    return !isSummaryBeforeCur && curRecord.isWrite();
+  }
+  isSummaryBeforeCur = false;
+  return curRecord.isWrite();
+}
+
 /*
  * This function analyzes the happens-before relationship between two memory
  * accesses based on their associated task labels. The idea is that task label
@@ -136,8 +203,8 @@ bool happensBefore(Label* histLabel, Label* curLabel, int& diffIndex) {
                 cur offset");
         return true;
       case eWorkShare:
-        if (static_cast<WorkShareSegment*>(histSegment)->isSingleExecutor() && 
-            static_cast<WorkShareSegment*>(curSegment)->isSingleExecutor()) { 
+        if (histSegment->isSingleExecutor() && 
+            curSegment->isSingleExecutor()) { 
           return analyzeSameTask(histLabel, curLabel, diffIndex);
         } else {
           return analyzeOrderedSection(histLabel, curLabel,  diffIndex);
@@ -207,8 +274,8 @@ bool analyzeSiblingImpTask(Label* histLabel, Label* curLabel, int diffIndex) {
    */
   if (histNextSegType == eWorkShare && curNextSegType == eWorkShare) {
     // in this case, it is possible to be ordered with ordered section
-    if (static_cast<WorkShareSegment*>(histNextSeg)->isSection() || 
-            static_cast<WorkShareSegment*>(curNextSeg)->isSection()) {
+    if (histNextSeg->isSection() || 
+            curNextSeg->isSection()) {
       // section construct does not have ordered section 
       return false;
     } 
@@ -230,18 +297,16 @@ bool analyzeSiblingImpTask(Label* histLabel, Label* curLabel, int diffIndex) {
  * are workshare task.
  */
 bool analyzeOrderedSection(Label* histLabel, Label* curLabel, int startIndex) {
-  auto histBaseSeg  = histLabel->getKthSegment(startIndex);
-  auto curBaseSeg = curLabel->getKthSegment(startIndex);
-  auto histSegment = static_cast<WorkShareSegment*>(histBaseSeg);
-  auto curSegment = static_cast<WorkShareSegment*>(curBaseSeg);
+  auto histSegment = histLabel->getKthSegment(startIndex);
+  auto curSegment = curLabel->getKthSegment(startIndex);
   if (histSegment->isPlaceHolder() || curSegment->isPlaceHolder()) {
     // have not entered the workshare construct yet.
     return false;
   } 
   auto histWorkShareId = histSegment->getWorkShareId();
   auto curWorkShareId = curSegment->getWorkShareId(); 
-  auto histPhase = histBaseSeg->getPhase();
-  auto curPhase = curBaseSeg->getPhase();
+  auto histPhase = histSegment->getPhase();
+  auto curPhase = curSegment->getPhase();
   auto histExitRank = computeExitRank(histPhase);
   auto curEnterRank = computeEnterRank(curPhase);
   if (histExitRank < curEnterRank) {
@@ -433,7 +498,7 @@ bool analyzeSameTask(Label* histLabel, Label* curLabel, int diffIndex) {
        * Be careful when histLabel[diffIndex+1] is place holder segment, 
        * in this case, happens-before relation hold
        */ 
-      if (static_cast<WorkShareSegment*>(histNextSeg)->isPlaceHolder()) {
+      if (histNextSeg->isPlaceHolder()) {
         return true;
       }
       return false; 
@@ -694,6 +759,19 @@ RecordManagement manageAccessRecord(const Record& histRecord,
                                     const Record& curRecord,
                                     bool isHistBeforeCurrent,
                                     int diffIndex) {
+  if (histRecord.isReadSummary() && !isHistBeforeCurrent) {
+    /*
+     * A concurrent read of another implicit task of the team in the same 
+     * barrier epoch joins the summary.
+     */
+    uint64_t threadNum;
+    if (isSummarizableRead(curRecord, threadNum) && 
+        isInSameBarrierEpoch(histRecord.getLabelId(), 
+            curRecord.getLabelId())) {
+      return eSkipAddCur;
+    }
+    return eNoOp;
+  }
   auto histIsWrite = histRecord.isWrite();  
   auto curIsWrite = curRecord.isWrite();
   auto histLockSet = histRecord.getLockSet();
@@ -713,16 +791,80 @@ RecordManagement manageAccessRecord(const Record& histRecord,
 /*
  * This function modifies the access record associated with a memory address
  * based on the management decision. It advances the iterator to the container
- * that holds access records 
+ * that holds access records. A history record is only superseded on the bytes
+ * that the current access touches, so it is erased once none of its bytes 
+ * remain.
  */
 void modifyAccessHistory(RecordManagement decision, 
-                         std::vector<Record>* records,
-                         std::vector<Record>::iterator& it) {
+                         RecordStorage* records,
+                         Record*& it,
+                         uint8_t curByteMask) {
   if (decision == eDelHist) {
-    it = records->erase(it);
-  } else {
-    it++;
+    it->clearBytes(curByteMask);
+    if (it->getByteMask() == 0) {
+      it = records->erase(it);
+      return;
+    }
+  }
+  it++;
+}
+
+/*
+ * Remove bytes in `byteMask` from all records of the access history. Records
+ * that do not cover any byte afterwards are erased.
+ */
+void clearRecordBytes(RecordStorage* records, uint8_t byteMask) {
+  auto it = records->begin();
+  while (it != records->end()) {
+    it->clearBytes(byteMask);
+    if (it->getByteMask() == 0) {
+      it = records->erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+/*
+ * A location read by all threads of a team would keep one read record per 
+ * thread, because concurrent reads do not prune each other. Once the current
+ * read and the records of the same bytes read by other implicit tasks of the 
+ * team in the same barrier epoch come from at least READ_SUMMARY_THRESHOLD 
+ * threads, replace these records with the current record marked as read 
+ * summary. The access history then stays bounded by the team size.
+ */
+void summarizeReads(RecordStorage* records, Record& curRecord) {
+  if (records->size() + 1 < READ_SUMMARY_THRESHOLD) {
+    return;
+  }
+  uint64_t threadNum;
+  if (!isSummarizableRead(curRecord, threadNum)) {
+    return;
+  }
+  auto curLabelId = curRecord.getLabelId();
+  auto curByteMask = curRecord.getByteMask();
+  uint64_t readers = 1ull << (threadNum % 64);
+  for (auto it = records->begin(); it != records->end(); ++it) {
+    if (it->getByteMask() == curByteMask && 
+        isSummarizableRead(*it, threadNum) &&
+        isInSameBarrierEpoch(it->getLabelId(), curLabelId)) {
+      readers |= 1ull << (threadNum % 64);
+    }
+  }
+  if (__builtin_popcountll(readers) < READ_SUMMARY_THRESHOLD) {
+    return;
+  }
+  auto it = records->begin();
+  while (it != records->end()) {
+    if (it->getByteMask() == curByteMask && 
+        isSummarizableRead(*it, threadNum) &&
+        isInSameBarrierEpoch(it->getLabelId(), curLabelId)) {
+      it = records->erase(it);
+    } else {
+      it++;
+    }
   }
+  curRecord.setReadSummary(true);
 }
 
 }
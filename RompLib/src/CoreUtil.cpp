@@ -96,4 +96,14 @@ void* computeAddressRangeEnd(void* baseAddr, size_t chunkSize) {
   return reinterpret_cast<void*>(rangeEnd);
 }
 
+/*
+ * Given the offset of the first accessed byte inside a shadow granule and the
+ * number of accessed bytes inside the granule, return the mask with bit i set
+ * if byte i of the granule is accessed. The granule is at most eight bytes.
+ */
+uint8_t computeByteMask(uint64_t offset, uint64_t numBytes) {
+  auto mask = (static_cast<uint32_t>(1) << numBytes) - 1;
+  return static_cast<uint8_t>(mask << offset);
+}
+
 }
@@ -4,7 +4,9 @@
 #include <glog/raw_logging.h>
 #include <memory>
 
+#include "AccessDedup.h"
 #include "AccessHistory.h"
+#include "Core.h"
 #include "CoreUtil.h"
 #include "QueryFuncs.h"
 #include "ShadowMemory.h"
@@ -13,6 +15,8 @@
 
 #define STATIC_THREAD_PRIVATE_LOWER_BOUND  0xfff8000000000000
 namespace romp {
+
+extern RompShadowMemory<AccessHistory> shadowMemory;
   
 /*
  * Analayze data sharing property of current memory access. 
@@ -63,7 +67,12 @@ DataSharingType analyzeDataSharing(const void* threadDataPtr,
 
 /*
  * This function is responsible for marking memory ranges in 
- * [lowerBound, upperBound] to be deallocated.
+ * [lowerBound, upperBound] to be deallocated. The shadow memory invalidates
+ * whole pages and generation blocks in the range by bumping their generation
+ * number, access histories are then reset lazily upon next access. Slots
+ * at the boundary of the range are marked as recycled one by one, except 
+ * for granules only partially covered by the range, which only drop the 
+ * records of the bytes in the range.
  */
 void recycleMemRange(void* lowerBound, void* upperBound) {
   if (upperBound < lowerBound) {
@@ -73,14 +82,19 @@ void recycleMemRange(void* lowerBound, void* upperBound) {
   }
   auto start = reinterpret_cast<uint64_t>(lowerBound);
   auto end = reinterpret_cast<uint64_t>(upperBound);
-  ShadowMemory<AccessHistory> shadowMemory;
-  for (auto addr = start; addr <= end; addr++) {
-    auto accessHistory = shadowMemory.getShadowMemorySlot(addr);
-    //std::unique_lock<std::mutex> guard(accessHistory->getMutex());
-    McsNode node;
-    LockGuard guard(&(accessHistory->getLock()), &node);
-    accessHistory->setFlag(eMemoryRecycled);
-  }
+  auto fullMask = getGranuleByteMask(shadowMemory.getGranuleSize());
+  shadowMemory.invalidateRange(start, end, 
+          [fullMask](AccessHistory* accessHistory, uint8_t byteMask) {
+    HistoryWriteGuard guard(accessHistory);
+    if (byteMask == fullMask) {
+      accessHistory->setFlag(eMemoryRecycled);
+    } else {
+      // bytes of the granule outside of the range are still in use
+      clearRecordBytes(accessHistory->getRecords(), byteMask);
+    }
+  });
+  // accesses deduplicated before the recycling have to be checked again
+  clearThreadDedupSet();
 }
 
 /*
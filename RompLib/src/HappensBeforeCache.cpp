@@ -0,0 +1,78 @@
+#include "HappensBeforeCache.h"
+
+#include <atomic>
+
+#include "Core.h"
+#include "ThreadRegistry.h"
+
+namespace romp {
+
+/*
+ * Taskwait and taskgroup sync marks are set in place on label segments of
+ * child tasks. Setting a mark can turn a concurrent pair of labels into an
+ * ordered pair, but never the other way around. So a cached ordered result
+ * stays valid, while a cached concurrent result is only valid if no sync mark
+ * has been set since it was computed. The sync epoch is advanced whenever a
+ * sync mark is set.
+ */
+std::atomic<uint32_t> gSyncEpoch(0);
+
+typedef struct HbCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  HbCacheStats* next;
+} HbCacheStats;
+
+ThreadRegistry<HbCacheStats> gHbCacheStats;
+
+thread_local HbCacheEntry tHbCache[HB_CACHE_SIZE];
+
+static uint64_t hashLabelPair(uint64_t histSerial, uint64_t curSerial) {
+  auto hash = histSerial ^ (curSerial * 0x9e3779b97f4a7c15);
+  return (hash * 0xff51afd7ed558ccd) >> (64 - HB_CACHE_BITS);
+}
+
+/*
+ * Memoized happensBefore(). Look up the pair of labels in the thread local
+ * cache first, compute and cache the result on a miss.
+ */
+bool happensBeforeCached(Label* histLabel, Label* curLabel, int& diffIndex) {
+  auto stats = gHbCacheStats.getThreadEntry();
+  auto syncEpoch = gSyncEpoch.load(std::memory_order_acquire);
+  auto histSerial = histLabel->getSerial();
+  auto curSerial = curLabel->getSerial();
+  auto& entry = tHbCache[hashLabelPair(histSerial, curSerial)];
+  if (entry.histSerial == histSerial && entry.curSerial == curSerial &&
+      (entry.isHistBeforeCur || entry.syncEpoch == syncEpoch)) {
+    stats->hits++;
+    diffIndex = entry.diffIndex;
+    return entry.isHistBeforeCur;
+  }
+  stats->misses++;
+  auto isHistBeforeCur = happensBefore(histLabel, curLabel, diffIndex);
+  entry.histSerial = histSerial;
+  entry.curSerial = curSerial;
+  entry.syncEpoch = syncEpoch;
+  entry.diffIndex = diffIndex;
+  entry.isHistBeforeCur = isHistBeforeCur;
+  return isHistBeforeCur;
+}
+
+void advanceSyncEpoch() {
+  gSyncEpoch.fetch_add(1, std::memory_order_release);
+}
+
+/*
+ * Sum up the cache statistics of all threads. Called at finalization when
+ * no thread is checking accesses any more.
+ */
+void getHappensBeforeCacheStats(uint64_t& hits, uint64_t& misses) {
+  hits = 0;
+  misses = 0;
+  gHbCacheStats.forEach([&](const HbCacheStats& stats) {
+    hits += stats.hits;
+    misses += stats.misses;
+  });
+}
+
+}
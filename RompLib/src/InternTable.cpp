@@ -0,0 +1,380 @@
+#include "InternTable.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "Label.h"
+#include "LockSet.h"
+#include "McsLock.h"
+#include "TaskData.h"
+
+/*
+ * Number of entries in the per-thread direct mapped cache of instruction
+ * address to site id.
+ */
+#define SITE_CACHE_SIZE 256
+
+/*
+ * Ids of released label entries are cached per thread and moved to and from
+ * the global pool in batches of LABEL_ID_BATCH ids.
+ */
+#define LABEL_ID_BATCH 64
+
+namespace romp {
+
+InternTable<LabelEntry> gLabelTable;
+InternTable<const LockSet*> gLockSetTable;
+InternTable<void*> gSiteTable;
+
+std::atomic<uint32_t> gNextOwnerId(NULL_INTERN_ID + 1);
+
+/*
+ * Global pool of released label ids. `gNumFreeLabelIds` lets a thread skip
+ * the lock while the pool has no full batch.
+ */
+McsLock gFreeLabelIdLock;
+std::atomic<uint32_t> gNumFreeLabelIds(0);
+
+/*
+ * The pool is never destroyed, so that entries released during program exit
+ * can still hand back their ids.
+ */
+static std::vector<uint32_t>* getFreeLabelIds() {
+  static auto freeLabelIds = new std::vector<uint32_t>();
+  return freeLabelIds;
+}
+
+typedef struct LabelIdCache {
+  uint32_t ids[2 * LABEL_ID_BATCH];
+  uint32_t numIds;
+} LabelIdCache;
+
+thread_local LabelIdCache tLabelIdCache;
+
+McsLock gSiteMapLock;
+std::unordered_map<void*, uint32_t> gSiteMap;
+
+typedef struct LockVectorHash {
+  size_t operator()(const std::vector<uint64_t>& locks) const {
+    uint64_t hash = locks.size();
+    for (const auto& lock : locks) {
+      hash = (hash ^ lock) * 0x9e3779b97f4a7c15;
+    }
+    return static_cast<size_t>(hash ^ (hash >> 32));
+  }
+} LockVectorHash;
+
+/*
+ * Map from the sorted locks of a lockset to the interned lockset. Interned
+ * locksets are never freed.
+ */
+McsLock gLockSetMapLock;
+std::unordered_map<std::vector<uint64_t>, const LockSet*, LockVectorHash> 
+    gLockSetMap;
+
+typedef struct SiteCacheEntry {
+  void* instnAddr;
+  uint32_t siteId;
+} SiteCacheEntry;
+
+thread_local SiteCacheEntry tSiteCache[SITE_CACHE_SIZE];
+
+/*
+ * Entry of the per-thread cache of lockset transitions: acquiring or 
+ * releasing `lock` while holding `from` leads to `to`.
+ */
+typedef struct LockSetCacheEntry {
+  const LockSet* from;
+  const LockSet* to;
+  uint64_t lock;
+  bool isAcquire;
+  bool isValid;
+} LockSetCacheEntry;
+
+thread_local LockSetCacheEntry tLockSetCache[LOCKSET_CACHE_SIZE];
+
+/*
+ * Add `entry` to the label table and return its id. Released ids are reused
+ * first, from the cache of the thread, then from the global pool.
+ */
+static uint32_t addLabelEntry(const LabelEntry& entry) {
+  auto& cache = tLabelIdCache;
+  if (cache.numIds == 0 && 
+      gNumFreeLabelIds.load(std::memory_order_relaxed) >= LABEL_ID_BATCH) {
+    McsNode node;
+    LockGuard guard(&gFreeLabelIdLock, &node);
+    auto freeLabelIds = getFreeLabelIds();
+    if (freeLabelIds->size() >= LABEL_ID_BATCH) {
+      std::copy(freeLabelIds->end() - LABEL_ID_BATCH, freeLabelIds->end(), 
+              cache.ids);
+      freeLabelIds->resize(freeLabelIds->size() - LABEL_ID_BATCH);
+      gNumFreeLabelIds.store(freeLabelIds->size(), std::memory_order_relaxed);
+      cache.numIds = LABEL_ID_BATCH;
+    }
+  }
+  if (cache.numIds == 0) {
+    return gLabelTable.add(entry);
+  }
+  auto id = cache.ids[--cache.numIds];
+  gLabelTable.reuse(id, entry);
+  return id;
+}
+
+/*
+ * Hand the id of a released label entry back for reuse. Once the cache of
+ * the thread is full, half of it goes to the global pool, so that ids
+ * released by one thread can be reused by others.
+ */
+static void freeLabelId(uint32_t id) {
+  auto& cache = tLabelIdCache;
+  cache.ids[cache.numIds++] = id;
+  if (cache.numIds < 2 * LABEL_ID_BATCH) {
+    return;
+  }
+  McsNode node;
+  LockGuard guard(&gFreeLabelIdLock, &node);
+  auto freeLabelIds = getFreeLabelIds();
+  freeLabelIds->insert(freeLabelIds->end(), cache.ids + LABEL_ID_BATCH, 
+          cache.ids + 2 * LABEL_ID_BATCH);
+  gNumFreeLabelIds.store(freeLabelIds->size(), std::memory_order_relaxed);
+  cache.numIds = LABEL_ID_BATCH;
+}
+
+/*
+ * Return the intern id of the current label of the task. The pair of label
+ * and task is added to the label table when the task runs with a new label,
+ * the task then drops its reference on the entry of its previous label.
+ * The task data is only accessed by the thread executing the task.
+ */
+uint32_t internTaskLabel(TaskData* taskData) {
+  auto label = taskData->label.get();
+  if (!label) {
+    return NULL_INTERN_ID;
+  }
+  if (taskData->internedLabel != label) {
+    auto labelId = addLabelEntry(LabelEntry{taskData->label, 
+            static_cast<void*>(taskData), taskData->teamId, 
+            taskData->barrierEpoch, taskData->isExplicitTask, 
+            taskData->expLocalId, 1});
+    releaseLabelEntry(taskData->labelId);
+    taskData->labelId = labelId;
+    taskData->internedLabel = label;
+  }
+  return taskData->labelId;
+}
+
+/*
+ * Take a reference on the label entry `id`. The caller already holds one,
+ * through the task or a record, so a released entry is never revived.
+ */
+void retainLabelEntry(uint32_t id) {
+  if (id == NULL_INTERN_ID) {
+    return;
+  }
+  __atomic_fetch_add(&gLabelTable.get(id).refCount, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Drop a reference on the label entry `id`. The last reference releases the
+ * label held by the entry and the id is reused. No record carries the id any
+ * more, so a record made after the reuse can not be mistaken for an older 
+ * one.
+ */
+void releaseLabelEntry(uint32_t id) {
+  if (id == NULL_INTERN_ID) {
+    return;
+  }
+  auto& entry = gLabelTable.get(id);
+  if (__atomic_sub_fetch(&entry.refCount, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+  entry = LabelEntry();
+  freeLabelId(id);
+}
+
+uint32_t internLockSet(const LockSet* lockSet) {
+  if (!lockSet) {
+    return NULL_INTERN_ID;
+  }
+  return lockSet->getInternId();
+}
+
+/*
+ * Return the interned lockset with `locks`, intern it if it does not exist.
+ */
+static const LockSet* internLocks(std::vector<uint64_t> locks) {
+  if (locks.empty()) {
+    return nullptr;
+  }
+  McsNode node;
+  LockGuard guard(&gLockSetMapLock, &node);
+  auto it = gLockSetMap.find(locks);
+  if (it != gLockSetMap.end()) {
+    return it->second;
+  }
+  auto lockSet = new LockSet(locks);
+  lockSet->setInternId(gLockSetTable.add(lockSet));
+  gLockSetMap.emplace(std::move(locks), lockSet);
+  return lockSet;
+}
+
+/*
+ * Return the lockset that a task holding `lockSet` moves to upon acquiring 
+ * (`isAcquire` is true) or releasing `lock`. Transitions are looked up in 
+ * the per-thread cache first, so that a repeated critical section does not 
+ * allocate or take the global lock.
+ */
+static const LockSet* getLockSetTransition(const LockSet* lockSet, 
+                                           uint64_t lock, bool isAcquire) {
+  auto key = reinterpret_cast<uint64_t>(lockSet) ^ (lock * 0x9e3779b97f4a7c15);
+  auto& cacheEntry = tLockSetCache[((key >> 32) ^ key ^ isAcquire) & 
+      (LOCKSET_CACHE_SIZE - 1)];
+  if (cacheEntry.isValid && cacheEntry.from == lockSet && 
+      cacheEntry.lock == lock && cacheEntry.isAcquire == isAcquire) {
+    return cacheEntry.to;
+  }
+  std::vector<uint64_t> locks;
+  if (lockSet) {
+    locks = lockSet->getLocks();
+  }
+  if (isAcquire) {
+    locks.insert(std::upper_bound(locks.begin(), locks.end(), lock), lock);
+  } else {
+    auto it = std::lower_bound(locks.begin(), locks.end(), lock);
+    if (it == locks.end() || *it != lock) {
+      RAW_LOG(FATAL, "cannot find lock to delete: %lu", lock);
+    }
+    locks.erase(it);
+  }
+  auto result = internLocks(std::move(locks));
+  cacheEntry.from = lockSet;
+  cacheEntry.to = result;
+  cacheEntry.lock = lock;
+  cacheEntry.isAcquire = isAcquire;
+  cacheEntry.isValid = true;
+  return result;
+}
+
+const LockSet* getLockSetAfterAcquire(const LockSet* lockSet, uint64_t lock) {
+  return getLockSetTransition(lockSet, lock, true);
+}
+
+const LockSet* getLockSetAfterRelease(const LockSet* lockSet, uint64_t lock) {
+  return getLockSetTransition(lockSet, lock, false);
+}
+
+/*
+ * Return the site id of instruction address `instnAddr`. The per-thread cache
+ * is checked first, a miss consults the global site map under lock.
+ */
+uint32_t internSite(void* instnAddr) {
+  auto key = reinterpret_cast<uint64_t>(instnAddr);
+  auto& cacheEntry = tSiteCache[(key ^ (key >> 8)) & (SITE_CACHE_SIZE - 1)];
+  if (cacheEntry.siteId != NULL_INTERN_ID &&
+      cacheEntry.instnAddr == instnAddr) {
+    return cacheEntry.siteId;
+  }
+  uint32_t id;
+  {
+    McsNode node;
+    LockGuard guard(&gSiteMapLock, &node);
+    auto it = gSiteMap.find(instnAddr);
+    if (it != gSiteMap.end()) {
+      id = it->second;
+    } else {
+      id = gSiteTable.add(instnAddr);
+      gSiteMap.emplace(instnAddr, id);
+    }
+  }
+  cacheEntry.instnAddr = instnAddr;
+  cacheEntry.siteId = id;
+  return id;
+}
+
+/*
+ * Return the id of the ownership epoch the task is in. Labels of a task are
+ * ordered, except for labels of different workshare units (loop chunks, 
+ * sections, single) that the task executes, which are logically concurrent.
+ * An ownership epoch is a stretch of execution of a task that does not 
+ * cross a workshare boundary, so that all labels of the epoch are ordered.
+ * The id is assigned on the first access in the epoch.
+ */
+uint32_t getTaskOwnerId(TaskData* taskData) {
+  if (taskData->ownerId == NULL_INTERN_ID) {
+    auto id = gNextOwnerId.fetch_add(1, std::memory_order_relaxed);
+    if (id == NULL_INTERN_ID) {
+      // the id wrapped around, skip the null id
+      id = gNextOwnerId.fetch_add(1, std::memory_order_relaxed);
+    }
+    taskData->ownerId = id;
+  }
+  return taskData->ownerId;
+}
+
+/*
+ * Called when the task crosses a workshare boundary, the next access starts
+ * a new ownership epoch.
+ */
+void resetTaskOwnerId(TaskData* taskData) {
+  taskData->ownerId = NULL_INTERN_ID;
+}
+
+Label* getInternedLabel(uint32_t id) {
+  if (id == NULL_INTERN_ID) {
+    return nullptr;
+  }
+  return gLabelTable.get(id).label.get();
+}
+
+void* getInternedTask(uint32_t id) {
+  if (id == NULL_INTERN_ID) {
+    return nullptr;
+  }
+  return gLabelTable.get(id).taskPtr;
+}
+
+const LabelEntry& getInternedLabelEntry(uint32_t id) {
+  return gLabelTable.get(id);
+}
+
+/*
+ * Return true if the task running with label `histLabelId` and the task 
+ * running with label `curLabelId` are bound to the same team, and the former
+ * ran in an earlier barrier epoch. The team barrier in between orders the
+ * two tasks without comparing their labels. Return false if the barrier 
+ * epochs do not tell.
+ */
+bool isOrderedByBarrier(uint32_t histLabelId, uint32_t curLabelId) {
+  const auto& histEntry = gLabelTable.get(histLabelId);
+  const auto& curEntry = gLabelTable.get(curLabelId);
+  return histEntry.teamId != 0 && histEntry.teamId == curEntry.teamId &&
+      histEntry.barrierEpoch < curEntry.barrierEpoch;
+}
+
+/*
+ * Return true if the tasks running with the two labels are bound to the same
+ * team and run between the same pair of team barriers.
+ */
+bool isInSameBarrierEpoch(uint32_t leftLabelId, uint32_t rightLabelId) {
+  const auto& leftEntry = gLabelTable.get(leftLabelId);
+  const auto& rightEntry = gLabelTable.get(rightLabelId);
+  return leftEntry.teamId != 0 && leftEntry.teamId == rightEntry.teamId &&
+      leftEntry.barrierEpoch == rightEntry.barrierEpoch;
+}
+
+const LockSet* getInternedLockSet(uint32_t id) {
+  if (id == NULL_INTERN_ID) {
+    return nullptr;
+  }
+  return gLockSetTable.get(id);
+}
+
+void* getInternedSite(uint32_t id) {
+  if (id == NULL_INTERN_ID) {
+    return nullptr;
+  }
+  return gSiteTable.get(id);
+}
+
+}
@@ -1,69 +1,221 @@
 #include "Label.h"
 
+#include <atomic>
 #include <glog/logging.h>
 #include <glog/raw_logging.h>
+#include <unordered_map>
+
+#include "McsLock.h"
+#include "SlabAllocator.h"
+
+/*
+ * Label nodes are hash-consed in a table of 2^LABEL_SHARD_BITS shards, each
+ * shard is protected by its own lock.
+ */
+#define LABEL_SHARD_BITS 6
+#define NUM_LABEL_SHARDS (1 << LABEL_SHARD_BITS)
+
+/*
+ * Each thread takes label serial numbers from the global counter in blocks
+ * of LABEL_SERIAL_BLOCK.
+ */
+#define LABEL_SERIAL_BLOCK 1024
 
 namespace romp {
 
-/* 
- * Use a shallow copy so that the new label does not create separate new 
- * segments. If later on some label segment changes, one should erase that 
- * label segment and create a new one otherwise the other label's content 
- * will be affected.
+/*
+ * A label node is identified by its parent node and the key of its segment.
  */
-Label::Label(const Label& label) {
-  _label = label._label; 
+typedef struct LabelKey {
+  const Label* parent;
+  const Segment* segment;
+  uint64_t hash;
+} LabelKey;
+
+struct LabelKeyHash {
+  size_t operator()(const LabelKey& key) const {
+    return key.hash;
+  }
+};
+
+struct LabelKeyEqual {
+  bool operator()(const LabelKey& lhs, const LabelKey& rhs) const {
+    return lhs.parent == rhs.parent && lhs.segment->hasSameKey(*rhs.segment);
+  }
+};
+
+/*
+ * The table does not own the label nodes. A node removes itself from the 
+ * table when its last reference goes away. `label` tells whether the entry
+ * still belongs to the node being released.
+ */
+typedef struct LabelRef {
+  Label* label;
+  std::weak_ptr<Label> ref;
+} LabelRef;
+
+typedef struct LabelShard {
+  LabelShard() { mcsInit(&lock); }
+  McsLock lock;
+  std::unordered_map<LabelKey, LabelRef, LabelKeyHash, LabelKeyEqual> labels;
+} LabelShard;
+
+/*
+ * The shards are never destroyed, so that labels released during program 
+ * exit can still unregister themselves.
+ */
+static LabelShard* getLabelShards() {
+  static auto shards = new LabelShard[NUM_LABEL_SHARDS];
+  return shards;
+}
+
+static LabelShard& getLabelShard(uint64_t hash) {
+  return getLabelShards()[hash >> (64 - LABEL_SHARD_BITS)];
+}
+
+std::atomic<uint64_t> gNextLabelSerial(1);
+
+thread_local uint64_t tNextLabelSerial = 0;
+thread_local uint64_t tLabelSerialEnd = 0;
+
+/*
+ * Return a serial number not given to any label before. 0 is never returned.
+ */
+static uint64_t getNextLabelSerial() {
+  if (tNextLabelSerial == tLabelSerialEnd) {
+    tNextLabelSerial = gNextLabelSerial.fetch_add(LABEL_SERIAL_BLOCK, 
+            std::memory_order_relaxed);
+    tLabelSerialEnd = tNextLabelSerial + LABEL_SERIAL_BLOCK;
+  }
+  return tNextLabelSerial++;
+}
+
+static uint64_t hashLabel(const Label* parent, const Segment& segment) {
+  auto hash = segment.getKeyHash() ^ 
+      (reinterpret_cast<uint64_t>(parent) * 0x9e3779b97f4a7c15);
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccd;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static void releaseLabel(Label* label) {
+  auto& shard = getLabelShard(label->getHash());
+  {
+    McsNode node;
+    LockGuard guard(&shard.lock, &node);
+    auto it = shard.labels.find(LabelKey{label->getParent().get(), 
+            &label->getSegment(), label->getHash()});
+    if (it != shard.labels.end() && it->second.label == label) {
+      shard.labels.erase(it);
+    }
+  }
+  slabDelete(label);
+}
+
+/*
+ * Return the label node made of `parent` followed by `segment`. If such a 
+ * node exists, it is returned. Otherwise a new node holding a copy of 
+ * `segment` is created.
+ */
+std::shared_ptr<Label> makeLabel(const std::shared_ptr<Label>& parent,
+                                 const Segment& segment) {
+  auto hash = hashLabel(parent.get(), segment);
+  auto& shard = getLabelShard(hash);
+  McsNode node;
+  LockGuard guard(&shard.lock, &node);
+  auto it = shard.labels.find(LabelKey{parent.get(), &segment, hash});
+  if (it != shard.labels.end()) {
+    auto label = it->second.ref.lock();
+    if (label) {
+      return label;
+    }
+    // the node is being released, replace it with a new node
+    shard.labels.erase(it);
+  }
+  auto label = std::shared_ptr<Label>(
+          slabNew<Label>(parent, segment, hash), releaseLabel, 
+          SlabAllocator<Label>());
+  shard.labels.emplace(LabelKey{parent.get(), &label->getSegment(), hash}, 
+          LabelRef{label.get(), label});
+  return label;
+}
+
+/*
+ * Set up the jump pointer with the skew-binary scheme: if the jump of the 
+ * parent and the jump of that jump cover the same distance, jump over both.
+ * Otherwise jump to the parent.
+ */
+Label::Label(const std::shared_ptr<Label>& parent,
+             const Segment& segment,
+             uint64_t hash): _parent(parent), _jump(this), _segment(segment),
+                             _length(1), _hash(hash), 
+                             _serial(getNextLabelSerial()) {
+  if (parent) {
+    _length = parent->_length + 1;
+    auto jump = parent->_jump;
+    if (parent->_length - jump->_length == 
+            jump->_length - jump->_jump->_length) {
+      _jump = jump->_jump;
+    } else {
+      _jump = parent.get();
+    }
+  }
 }
 
 std::string Label::toString() const {
   auto result = std::string("");
-  for (const auto& segment : _label) {
-    result += segment->toString();
+  for (int i = 0; i < _length; ++i) {
+    result += getKthSegment(i)->toString();
     result += std::string(" | ");
   }
   return result;
 }
 
-void Label::appendSegment(const std::shared_ptr<Segment>& segment) {
-  _label.push_back(segment);
+const std::shared_ptr<Label>& Label::getParent() const {
+  return _parent;
 }
 
-std::shared_ptr<Segment> Label::popSegment() {
-  if (_label.empty()) {
-    RAW_LOG(FATAL, "label is empty");
-  }
-  auto lastSegment = _label.back();
-  _label.pop_back();
-  return lastSegment;
+const Segment& Label::getSegment() const {
+  return _segment;
 }
 
-std::shared_ptr<Segment> Label::getLastKthSegment(int k) {
-  if (k > _label.size()) {
-    RAW_LOG(FATAL, "index is out of bound");
-    return nullptr;
-  }
-  auto len = _label.size();
-  return _label.at(len - k);
+uint64_t Label::getHash() const {
+  return _hash;
 }
 
-void Label::setLastKthSegment(int k, const std::shared_ptr<Segment>& segment) { 
-  if (k > _label.size()) {
-    RAW_LOG(FATAL, "%s %d", "set value out of bound", k);
-    return;
-  }
-  auto len = _label.size();
-  _label[len - k] = std::move(segment);
+uint64_t Label::getSerial() const {
+  return _serial;
 }
 
-Segment* Label::getKthSegment(int k) {
-  if (k > _label.size()) {
+/*
+ * Return the node whose last segment is the k-th segment of this label.
+ */
+const Label* Label::_getKthNode(int k) const {
+  if (k < 0 || k >= _length) {
     RAW_LOG(FATAL, "index %d out of bound", k);
   }
-  return _label.at(k).get();
+  auto node = this;
+  while (node->_length > k + 1) {
+    if (node->_jump->_length > k) {
+      node = node->_jump;
+    } else {
+      node = node->_parent.get();
+    }
+  }
+  return node;
+}
+
+Segment* Label::getLastKthSegment(int k) const {
+  return &_getKthNode(_length - k)->_segment;
+}
+
+Segment* Label::getKthSegment(int k) const {
+  return &_getKthNode(k)->_segment;
 }
 
 int Label::getLabelLength() const {
-  return _label.size();
+  return _length;
 }
 
 /*
@@ -72,17 +224,27 @@ int Label::getLabelLength() const {
  * the index of the position. If 'left' is the prefix of 'right', reutrn -1 
  * (eLeftIsPrefix) If 'right' is the prefix of 'left',return -2 (eRightIsPrefix)
  * If the labels are the same, return -3 (eSame)
+ * Because label nodes are hash-consed, the common prefix of the two labels is
+ * a shared node. Only segments below the shared node are compared.
  */
 int compareLabels(Label* left, Label* right) {
-  auto& leftLabel = left->_label;
-  auto& rightLabel = right->_label;  
-  auto lenLeftLabel = leftLabel.size();
-  auto lenRightLabel = rightLabel.size();
+  auto lenLeftLabel = left->_length;
+  auto lenRightLabel = right->_length;
   auto len = std::min(lenLeftLabel, lenRightLabel);
-  for (int i = 0; i < len; ++i) {
-    if (*leftLabel.at(i) != *rightLabel.at(i)) {
-      return i;
+  auto leftNode = left->_getKthNode(len - 1);
+  auto rightNode = right->_getKthNode(len - 1);
+  auto diffIndex = -1;
+  auto index = len - 1;
+  while (leftNode != rightNode) {
+    if (leftNode->_segment != rightNode->_segment) {
+      diffIndex = index;
     }
+    leftNode = leftNode->_parent.get();
+    rightNode = rightNode->_parent.get();
+    index--;
+  }
+  if (diffIndex >= 0) {
+    return diffIndex;
   }
   // reach the end, one label is the prefix of another label
   if (lenLeftLabel == lenRightLabel) {
@@ -94,41 +256,50 @@ int compareLabels(Label* left, Label* right) {
   return static_cast<int>(eRightIsPrefix);
 }
 
+/*
+ * Return the label with the last segment of `label` removed.
+ */
+static std::shared_ptr<Label> popLastSegment(Label* label) {
+  if (!label->getParent()) {
+    RAW_LOG(FATAL, "label is empty");
+  }
+  return label->getParent();
+}
+
+/*
+ * Return the label with the last segment of `label` replaced by `segment`.
+ */
+static std::shared_ptr<Label> replaceLastSegment(Label* label, 
+        const Segment& segment) {
+  return makeLabel(label->getParent(), segment);
+}
+
 std::shared_ptr<Label> genImpTaskLabel(
                            Label* parentLabel,
                            unsigned int index,
                            unsigned int actualParallelism) {
-  // create the new label by copy constructing from parent label
-  auto newLabel = std::make_shared<Label>(*parentLabel);
-  // create a new label segment
-  auto newSegment = std::make_shared<BaseSegment>(eImplicit, 
+  // create a new label segment and append it to the parent label
+  auto newSegment = Segment(eImplicit, 
           static_cast<uint64_t>(index), 
           static_cast<uint64_t>(actualParallelism));
-  newLabel->appendSegment(newSegment);
-  return newLabel;
+  return makeLabel(parentLabel->shared_from_this(), newSegment);
 }
 
 std::shared_ptr<Label> genInitTaskLabel() {
-  auto label = std::make_shared<Label>();
-  auto segment = std::make_shared<BaseSegment>(eImplicit, 0, 1);
-  label->appendSegment(segment);
-  return label;
+  auto segment = Segment(eImplicit, 0, 1);
+  return makeLabel(nullptr, segment);
 }
 
 /*
  * Given the parent task label, generate the label for the explicit task.
  */
 std::shared_ptr<Label> genExpTaskLabel(Label* parentLabel) {
-  auto newLabel = std::make_shared<Label>(*parentLabel);
-  auto segment = std::make_shared<BaseSegment>(eExplicit, 0, 1); 
-  newLabel->appendSegment(segment);
-  return newLabel;
+  auto segment = Segment(eExplicit, 0, 1); 
+  return makeLabel(parentLabel->shared_from_this(), segment);
 }
 
 std::shared_ptr<Label> mutateParentImpEnd(Label* childLabel) {
-  auto newLabel = std::make_shared<Label>(*childLabel);
-  newLabel->popSegment();       
-  return newLabel;
+  return popLastSegment(childLabel);
 }
 
 /*
@@ -136,13 +307,11 @@ std::shared_ptr<Label> mutateParentImpEnd(Label* childLabel) {
  * of parent task.
  */
 std::shared_ptr<Label> mutateParentTaskCreate(Label* parentLabel) {
-  auto newLabel = std::make_shared<Label>(*parentLabel);  
-  auto lastSegment = newLabel->popSegment();
-  auto taskCreate = lastSegment->getTaskcreate();
-  auto newSegment = lastSegment->clone();
-  newSegment->setTaskcreate(taskCreate + 1);  
-  newLabel->appendSegment(newSegment);
-  return newLabel;
+  auto lastSegment = parentLabel->getSegment();
+  auto taskCreate = lastSegment.getTaskcreate();
+  auto newSegment = lastSegment;
+  newSegment.setTaskcreate(taskCreate + 1);  
+  return replaceLastSegment(parentLabel, newSegment);
 }
 
 /*
@@ -151,16 +320,15 @@ std::shared_ptr<Label> mutateParentTaskCreate(Label* parentLabel) {
  * the second last segment of the label.
  */
 std::shared_ptr<Label> mutateBarrierEnd(Label* label) {
-  auto newLabel = std::make_shared<Label>(*label);
-  auto segment = newLabel->getLastKthSegment(2); //get the second last segment
+  auto parentLabel = popLastSegment(label);
+  auto segment = parentLabel->getSegment(); //get the second last segment
   uint64_t offset, span; 
-  segment->getOffsetSpan(offset, span); //get the offset and span value
+  segment.getOffsetSpan(offset, span); //get the offset and span value
   offset += span;
-  //because we don't know the actual derived type of segment, should do a clone
-  auto newSegment = segment->clone(); 
-  newSegment->setOffsetSpan(offset, span); //set the new offset and span
-  newLabel->setLastKthSegment(2, newSegment); 
-  return newLabel; 
+  auto newSegment = segment; 
+  newSegment.setOffsetSpan(offset, span); //set the new offset and span
+  auto newParentLabel = replaceLastSegment(parentLabel.get(), newSegment);
+  return makeLabel(newParentLabel, label->getSegment()); 
 } 
 
 /*
@@ -169,14 +337,12 @@ std::shared_ptr<Label> mutateBarrierEnd(Label* label) {
  * field counter in the last label segment
  */ 
 std::shared_ptr<Label> mutateTaskWait(Label* label) {
-  auto newLabel = std::make_shared<Label>(*label);
-  auto lastSegment = newLabel->popSegment(); // replace the last segment
-  auto taskwait = lastSegment->getTaskwait();
+  auto lastSegment = label->getSegment(); // replace the last segment
+  auto taskwait = lastSegment.getTaskwait();
   taskwait += 1;
-  auto newSegment = lastSegment->clone();
-  newSegment->setTaskwait(taskwait);
-  newLabel->appendSegment(newSegment);
-  return newLabel;
+  auto newSegment = lastSegment;
+  newSegment.setTaskwait(taskwait);
+  return replaceLastSegment(label, newSegment);
 }
 
 /*
@@ -185,14 +351,12 @@ std::shared_ptr<Label> mutateTaskWait(Label* label) {
  * the `phase` counter value by one.
  */
 std::shared_ptr<Label> mutateOrderSection(Label* label) {
-  auto newLabel = std::make_shared<Label>(*label);
-  auto lastSegment = newLabel->popSegment(); // replace the last segment
-  auto phase = lastSegment->getPhase();
+  auto lastSegment = label->getSegment(); // replace the last segment
+  auto phase = lastSegment.getPhase();
   phase += 1;
-  auto newSegment = lastSegment->clone();
-  newSegment->setPhase(phase);
-  newLabel->appendSegment(newSegment);
-  return newLabel;
+  auto newSegment = lastSegment;
+  newSegment.setPhase(phase);
+  return replaceLastSegment(label, newSegment);
 }
 
 /*
@@ -200,11 +364,9 @@ std::shared_ptr<Label> mutateOrderSection(Label* label) {
  * to mark the begin of the workshare loop.
  */
 std::shared_ptr<Label> mutateLoopBegin(Label* label) {
-  auto newLabel = std::make_shared<Label>(*label); 
-  auto newSegment = std::make_shared<WorkShareSegment>(); 
-  newSegment->setPlaceHolderFlag(true);
-  newLabel->appendSegment(newSegment);   
-  return newLabel;
+  auto newSegment = Segment(0, false); 
+  newSegment.setPlaceHolderFlag(true);
+  return makeLabel(label->shared_from_this(), newSegment);
 }
 
 /*
@@ -213,15 +375,13 @@ std::shared_ptr<Label> mutateLoopBegin(Label* label) {
  * segment by one (should replace the old one)
  */
 std::shared_ptr<Label> mutateLoopEnd(Label* label) {
-  auto newLabel = std::make_shared<Label>(*label); 
-  newLabel->popSegment();
-  auto segment = newLabel->popSegment();
-  auto loopCount = segment->getLoopCount();
+  auto parentLabel = popLastSegment(label);
+  auto segment = parentLabel->getSegment();
+  auto loopCount = segment.getLoopCount();
   loopCount += 1;
-  auto newSegment = segment->clone(); 
-  newSegment->setLoopCount(loopCount);
-  newLabel->appendSegment(newSegment);
-  return newLabel;
+  auto newSegment = segment; 
+  newSegment.setLoopCount(loopCount);
+  return replaceLastSegment(parentLabel.get(), newSegment);
 }
 
 /*
@@ -243,11 +403,9 @@ std::shared_ptr<Label> mutateSectionEnd(Label* label) {
  */
 std::shared_ptr<Label> mutateSingleExecBegin(Label* label) {
   RAW_DLOG(INFO, "mutateSingleExecBegin");
-  auto newLabel = std::make_shared<Label>(*label); 
-  auto newSegment = std::make_shared<WorkShareSegment>(); 
-  newSegment->setSingleFlag(true);
-  newLabel->appendSegment(newSegment);   
-  return newLabel;
+  auto newSegment = Segment(0, false); 
+  newSegment.setSingleFlag(true);
+  return makeLabel(label->shared_from_this(), newSegment);
 }
 
 /*
@@ -255,9 +413,7 @@ std::shared_ptr<Label> mutateSingleExecBegin(Label* label) {
  * executor. Pop the workshare segment.
  */
 std::shared_ptr<Label> mutateSingleEnd(Label* label) {
-  auto newLabel = std::make_shared<Label>(*label);
-  newLabel->popSegment();
-  return newLabel;
+  return popLastSegment(label);
 }
 
 /*
@@ -268,11 +424,9 @@ std::shared_ptr<Label> mutateSingleEnd(Label* label) {
  * other bit.
  */
 std::shared_ptr<Label> mutateSingleOtherBegin(Label* label) {
-  auto newLabel = std::make_shared<Label>(*label); 
-  auto newSegment = std::make_shared<WorkShareSegment>(); 
-  newSegment->setSingleFlag(false);
-  newLabel->appendSegment(newSegment);   
-  return newLabel;
+  auto newSegment = Segment(0, false); 
+  newSegment.setSingleFlag(false);
+  return makeLabel(label->shared_from_this(), newSegment);
 }
 
 /*
@@ -301,12 +455,10 @@ std::shared_ptr<Label> mutateTaskLoopEnd(Label* label) {
  */
 std::shared_ptr<Label> mutateWorkShareDispatch(
         Label* label, uint64_t id, bool isSection) {
-  auto newLabel = std::make_shared<Label>(*label); 
-  auto segment = newLabel->popSegment();
-  RAW_DCHECK(segment->getType() == eWorkShare, "not a workshare segment");
-  auto newSegment = std::make_shared<WorkShareSegment>(id, isSection); 
-  newLabel->appendSegment(newSegment);   
-  return newLabel;
+  auto segment = label->getSegment();
+  RAW_DCHECK(segment.getType() == eWorkShare, "not a workshare segment");
+  auto newSegment = Segment(id, isSection); 
+  return replaceLastSegment(label, newSegment);
 }
 
 std::shared_ptr<Label> mutateIterDispatch(Label* label, uint64_t id) {
@@ -323,17 +475,15 @@ std::shared_ptr<Label> mutateSectionDispatch(Label* label, void* id) {
  * task group id by one
  */
 std::shared_ptr<Label> mutateTaskGroupBegin(Label* label) {
- auto newLabel = std::make_shared<Label>(*label);      
- auto segment = newLabel->popSegment();
- auto taskGroupId = segment->getTaskGroupId();
+ auto segment = label->getSegment();
+ auto taskGroupId = segment.getTaskGroupId();
  taskGroupId += 1;
- auto taskGroupLevel = segment->getTaskGroupLevel();
+ auto taskGroupLevel = segment.getTaskGroupLevel();
  taskGroupLevel += 1;
- auto newSegment = segment->clone();
- newSegment->setTaskGroupId(taskGroupId);
- newSegment->setTaskGroupLevel(taskGroupLevel);
- newLabel->appendSegment(newSegment);
- return newLabel;
+ auto newSegment = segment;
+ newSegment.setTaskGroupId(taskGroupId);
+ newSegment.setTaskGroupLevel(taskGroupLevel);
+ return replaceLastSegment(label, newSegment);
 }
 
 /*
@@ -342,18 +492,16 @@ std::shared_ptr<Label> mutateTaskGroupBegin(Label* label) {
  * the task group id by one
  */
 std::shared_ptr<Label> mutateTaskGroupEnd(Label* label) {
-  auto newLabel = std::make_shared<Label>(*label);
-  auto segment = newLabel->popSegment();
-  auto taskGroupId = segment->getTaskGroupId();
+  auto segment = label->getSegment();
+  auto taskGroupId = segment.getTaskGroupId();
   taskGroupId += 1;
-  auto taskGroupLevel = segment->getTaskGroupLevel();
+  auto taskGroupLevel = segment.getTaskGroupLevel();
   taskGroupLevel -= 1;
   RAW_CHECK(taskGroupLevel >= 0, "not expecting task group level < 0");
-  auto newSegment = segment->clone();
-  newSegment->setTaskGroupId(taskGroupId);
-  newSegment->setTaskGroupLevel(taskGroupLevel);
-  newLabel->appendSegment(newSegment);
-  return newLabel;
+  auto newSegment = segment;
+  newSegment.setTaskGroupId(taskGroupId);
+  newSegment.setTaskGroupLevel(taskGroupLevel);
+  return replaceLastSegment(label, newSegment);
 }
 
 /*
@@ -365,22 +513,22 @@ std::shared_ptr<Label> mutateTaskComplete(Label* label) {
   if (!label) {
     return nullptr;
   }
-  auto newLabel = std::make_shared<Label>(*label);
-  auto lastSeg = newLabel->popSegment();       
-  auto lastSegType = lastSeg->getType(); 
+  auto lastSegType = label->getSegment().getType(); 
   RAW_CHECK(lastSegType == eExplicit, "last segment should be explicit");
+  auto newLabel = popLastSegment(label);
   return newLabel;
 }
 
 /*
  * Mutate the label of the child task inside a taskgroup construct when the 
  * taskgroup construct finishes. Set the taskgroup sync mark.
+ * The sync mark is not part of the segment key, the mark is set in place on
+ * the label node so that access records holding the label observe it.
  */
 std::shared_ptr<Label> mutateTaskGroupSyncChild(Label* label) {
-  auto newLabel = std::make_shared<Label>(*label); 
-  auto lastSeg = newLabel->getLastKthSegment(1);
+  auto lastSeg = label->getLastKthSegment(1);
   lastSeg->setTaskGroupSync();
-  return newLabel;
+  return label->shared_from_this();
 }
 
 
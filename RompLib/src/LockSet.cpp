@@ -1,116 +1,109 @@
 #include "LockSet.h"
 
-#include <algorithm>
-#include <glog/logging.h>
-#include <glog/raw_logging.h>
+#include <sstream>
 
 namespace romp {
 
-SmallLockSet::SmallLockSet() {
-  for (int i = 0; i < 4; ++i) {
-    _locks[i] = 0;
+LockSet::LockSet(std::vector<uint64_t> locks):
+    _locks(std::move(locks)), _signature(0), _internId(0) {
+  for (const auto& lock : _locks) {
+    _signature |= getLockSignature(lock);
   }
-  _numLocks = 0;
 }
 
-SmallLockSet::SmallLockSet(const SmallLockSet& lockset) {
-  for (int i = 0; i < lockset._numLocks; ++i) {
-    _locks[i] = lockset._locks[i];
-  }
-  _numLocks = lockset._numLocks;
-}
-
-std::string SmallLockSet::toString() const {
+std::string LockSet::toString() const {
   std::stringstream stream;
-  for (int i = 0; i < _numLocks; ++i) {
-    stream << std::hex << _locks[i] << "|";
+  for (const auto& lock : _locks) {
+    stream << std::hex << lock << "|";
   }
   auto result = "<" + stream.str() + ">";
   return result;
 }
 
-void SmallLockSet::addLock(uint64_t lock) {
-  if (_numLocks == 4) {
-    RAW_LOG(FATAL, "number of nesting locks exceeds limit of 4");
-  }  
-  _locks[_numLocks] = lock; 
-  _numLocks++;
-}
-
 /*
  * Compute the intersect of two set of locks
  * Return true if two set of locks have common lock
  * Return false otherwise
  */
-bool SmallLockSet::hasCommonLock(const LockSet& other) const {
-  auto otherLockSet = dynamic_cast<const SmallLockSet&>(other);
-  auto otherNumLocks = otherLockSet._numLocks;
-  for (int i = 0; i < _numLocks; ++i) {
-    auto lock = _locks[i];
-    for (int j = 0; j < otherNumLocks; ++j) {
-      auto otherLock = otherLockSet._locks[j]; 
-      if (otherLock == lock) {
-        return true;
-      } 
-    } 
+bool LockSet::hasCommonLock(const LockSet& other) const {
+  if ((_signature & other._signature) == 0) {
+    return false;
+  }
+  if (this == &other) {
+    return true;
+  }
+  // both lock arrays are sorted, walk them in step
+  auto i = 0, j = 0;
+  auto numLocks = static_cast<int>(_locks.size());
+  auto otherNumLocks = static_cast<int>(other._locks.size());
+  while (i < numLocks && j < otherNumLocks) {
+    if (_locks[i] == other._locks[j]) {
+      return true;
+    } else if (_locks[i] < other._locks[j]) {
+      i++;
+    } else {
+      j++;
+    }
   }
   return false;
 }
 
-void* SmallLockSet::getLocks() {
-  return static_cast<void*>(_locks);
+const std::vector<uint64_t>& LockSet::getLocks() const {
+  return _locks;
 }
 
-void SmallLockSet::removeLock(uint64_t lock) {
-  auto index = -1;
-  for (int i = 0; i < _numLocks; ++i) {
-    if (_locks[i] == lock) {
-      index = i; 
-      break;
-    }
-  }
-  if (index == -1) {
-    RAW_LOG(FATAL, "cannot find lock to delete: %lu", lock);
-  }
-  for (int i = index + 1; i < _numLocks; ++i) {
-    _locks[i - 1] = _locks[i];
-  }
-  _numLocks--;
+uint16_t LockSet::getNumLocks() const {
+  return static_cast<uint16_t>(_locks.size());
 }
 
-uint16_t SmallLockSet::getNumLocks() const {
-  return _numLocks;
+uint64_t LockSet::getSignature() const {
+  return _signature;
 }
+
+uint32_t LockSet::getInternId() const {
+  return _internId;
+}
+
+/*
+ * Set once by the intern table, before the lockset is published.
+ */
+void LockSet::setInternId(uint32_t id) {
+  _internId = id;
+}
+
+/*
+ * Return the signature bit of `lock`.
+ */
+uint64_t getLockSignature(uint64_t lock) {
+  return 1UL << ((lock * 0x9e3779b97f4a7c15) >> 58);
+}
+
 /*
  * Return true if lock set `me` is the subset of lock set `other`
  */
-bool isSubset(LockSet* me, LockSet* other) {
-  if (me == nullptr) {
+bool isSubset(const LockSet* me, const LockSet* other) {
+  if (me == nullptr || me == other) {
     return true;
   } else if (other == nullptr) {
     return false;
   }
-  auto numLocksMe= me->getNumLocks();
-  auto numLocksOther = other->getNumLocks();
-  if (numLocksOther < numLocksMe) {
+  if ((me->getSignature() & ~other->getSignature()) != 0 ||
+      me->getNumLocks() > other->getNumLocks()) {
     return false;
   }
-  auto meLocks = me->getLocks();
-  auto otherLocks = other->getLocks();
-  for (int i = 0; i < numLocksMe; ++i) {
-    auto lock = static_cast<uint64_t*>(meLocks)[i];
-    for (int j = 0; j < numLocksOther; ++j) {
-      auto otherLock = static_cast<uint64_t*>(otherLocks)[j];
-      if (otherLock != lock) {
-        return false; 
-      }
-    } 
+  const auto& meLocks = me->getLocks();
+  const auto& otherLocks = other->getLocks();
+  size_t j = 0;
+  for (const auto& lock : meLocks) {
+    while (j < otherLocks.size() && otherLocks[j] < lock) {
+      j++;
+    }
+    if (j == otherLocks.size() || otherLocks[j] != lock) {
+      return false;
+    }
+    j++;
   }
   return true;
 }
 
-std::shared_ptr<LockSet> SmallLockSet::clone() const {
-  return std::make_shared<SmallLockSet>(*this);
-}
-
 }
@@ -65,10 +65,79 @@
 
 #include "McsLock.h"
 
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//******************************************************************************
+// private data
+//******************************************************************************
+
+#ifdef MCS_FUTEX_PARKING
+static std::atomic_bool parkingEnabled(true);
+#else
+static std::atomic_bool parkingEnabled(false);
+#endif
+
 //******************************************************************************
 // private operations
 //******************************************************************************
 
+static void
+futexWait(std::atomic<int> *word, int value)
+{
+  syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAIT_PRIVATE, value,
+          nullptr, nullptr, 0);
+}
+
+
+static void
+futexWake(std::atomic<int> *word)
+{
+  syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAKE_PRIVATE, 1,
+          nullptr, nullptr, 0);
+}
+
+
+//------------------------------------------------------------------------------
+// wait until my predecessor hands the lock over. poll for a while, since 
+// critical sections are short. then, if parking is enabled, announce that I
+// park and sleep on the futex, so that a preempted lock holder does not make
+// me burn the rest of my quantum.
+// note: acquire order ensures that reads or writes in the critical section 
+//       will not occur until after blocked is cleared
+//------------------------------------------------------------------------------
+static void
+mcsWait(McsNode *me)
+{
+  for (int i = 0; i < MCS_SPIN_LIMIT; ++i) {
+    if (std::atomic_load_explicit(&me->blocked, std::memory_order_acquire) ==
+        MCS_GRANTED) {
+      return;
+    }
+  }
+  if (!parkingEnabled.load(std::memory_order_relaxed)) {
+    while (std::atomic_load_explicit(&me->blocked, std::memory_order_acquire)
+           != MCS_GRANTED);
+    return;
+  }
+  int state = MCS_WAITING;
+  if (me->blocked.compare_exchange_strong(state, MCS_PARKED,
+                                          std::memory_order_acquire,
+                                          std::memory_order_acquire)) {
+    state = MCS_PARKED;
+  }
+  while (state != MCS_GRANTED) {
+    futexWait(&me->blocked, MCS_PARKED);
+    state = std::atomic_load_explicit(&me->blocked, std::memory_order_acquire);
+  }
+}
+
 //******************************************************************************
 // interface operations
 //******************************************************************************
@@ -98,7 +167,7 @@ mcsLock(McsLock *l, McsNode *me)
     //------------------------------------------------------------------
     // prepare to block until signaled by my predecessor
     //------------------------------------------------------------------
-    std::atomic_init(&me->blocked, true);
+    std::atomic_init(&me->blocked, MCS_WAITING);
 
     //------------------------------------------------------------------
     // link behind my predecessor
@@ -110,11 +179,8 @@ mcsLock(McsLock *l, McsNode *me)
 
     //------------------------------------------------------------------
     // wait for my predecessor to clear my flag
-    // note: use acquire order to ensure that reads or writes in the
-    //       critical section will not occur until after blocked is
-    //       cleared
     //------------------------------------------------------------------
-    while (std::atomic_load_explicit(&me->blocked, std::memory_order_acquire));
+    mcsWait(me);
   }
 }
 
@@ -174,12 +240,41 @@ mcsUnlock(McsLock *l, McsNode *me)
 
     //------------------------------------------------------------------
     // another thread is writing me->next to define itself as our successor;
-    // wait for it to finish that
+    // wait for it to finish that. it may be preempted in between, so 
+    // give way to it once in a while
     //------------------------------------------------------------------
+    int polls = 0;
     while (MCS_NIL == (successor = std::atomic_load_explicit(&me->next, 
-				    std::memory_order_acquire)));
+				    std::memory_order_acquire))) {
+      if (++polls == MCS_SPIN_LIMIT) {
+        sched_yield();
+        polls = 0;
+      }
+    }
   }
 
-  std::atomic_store_explicit(&successor->blocked, false, 
-		  std::memory_order_release);
+  //--------------------------------------------------------------------
+  // hand the lock over and wake the successor if it has parked.
+  // note: the successor's node may go out of scope as soon as it sees the 
+  //       lock granted, the wake then hits a stale futex word at worst, 
+  //       which waiters of any futex have to tolerate as a spurious wake
+  //--------------------------------------------------------------------
+  if (std::atomic_exchange_explicit(&successor->blocked, MCS_GRANTED, 
+		  std::memory_order_release) == MCS_PARKED) {
+    futexWake(&successor->blocked);
+  }
+}
+
+
+void
+mcsSetParking(bool enabled)
+{
+  parkingEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+
+bool
+mcsParkingEnabled()
+{
+  return parkingEnabled.load(std::memory_order_relaxed);
 }
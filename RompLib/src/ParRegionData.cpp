@@ -3,16 +3,36 @@
 #include <glog/logging.h>
 #include <glog/raw_logging.h>
 
+#include "TaskData.h"
+
 namespace romp {
 
+std::atomic<uint32_t> gNextTeamId(1); // team id 0 means no team
+
 /*
  * This function maintains task dependence relationship upon task dependence
- * callback. Task dependence forms a directed acyclic graph. 
+ * callback. Task dependence forms a directed acyclic graph. Most regions 
+ * have no task dependence, so the graph is created upon the first one. The
+ * graph itself is safe for concurrent use.
  */
-void maintainTaskDeps(const ompt_dependence_t& dependence, 
+void maintainTaskDeps(const ompt_dependence_t* deps, 
+		      int ndeps,
 		      void* taskPtr,
 		      ParRegionData* parRegionData) {
-  parRegionData->taskDepGraph.addDeps(dependence, taskPtr);   
+  auto taskDepGraph = parRegionData->taskDepGraph.load(
+          std::memory_order_acquire);
+  if (!taskDepGraph) {
+    McsNode node;
+    LockGuard guard(&(parRegionData->lock), &node);
+    taskDepGraph = parRegionData->taskDepGraph.load(
+            std::memory_order_relaxed);
+    if (!taskDepGraph) {
+      taskDepGraph = new TaskDepGraph();
+      parRegionData->taskDepGraph.store(taskDepGraph, 
+              std::memory_order_release);
+    }
+  }
+  taskDepGraph->addDeps(deps, ndeps, static_cast<TaskData*>(taskPtr));   
 }
 
 }
@@ -1,5 +1,7 @@
 #include "Record.h"
 
+#include "InternTable.h"
+
 namespace romp {
   
 /*
@@ -28,6 +30,20 @@ void Record::setHasHwLock(bool hwLock) {
   }
 }
 
+/*
+ * A read summary record stands for the concurrent reads of several implicit 
+ * tasks of one team within a barrier epoch. The record keeps the label and 
+ * instruction of one of the readers. If the record is a read summary, set 
+ * the third lowest bit to 1, otherwise, set to 0.
+ */
+void Record::setReadSummary(bool isSummary) {
+  if (isSummary) {
+    _state |= 0x4;
+  } else {
+    _state &= 0xfb;
+  }
+}
+
 bool Record::isWrite() const {
   return (_state & 0x1) == 0x1;
 }
@@ -35,30 +51,60 @@ bool Record::isWrite() const {
 bool Record::hasHwLock() const {
   return (_state & 0x2) == 0x2;
 }
+
+bool Record::isReadSummary() const {
+  return (_state & 0x4) == 0x4;
+}
+
+/*
+ * One shadow memory slot covers an aligned granule of up to eight bytes. 
+ * Bit i of the byte mask is set if the access touched byte i of the granule.
+ */
+uint8_t Record::getByteMask() const {
+  return _byteMask;
+}
+
+/*
+ * Remove bytes in `byteMask` from the bytes covered by this record. A record
+ * whose byte mask becomes zero no longer describes any access.
+ */
+void Record::clearBytes(uint8_t byteMask) {
+  _byteMask &= ~byteMask;
+}
 /*
  * toString() is mainly for debugging
  */
 std::string Record::toString() const {
   std::string result = "";
-  auto labelStr = _label? _label->toString() : std::string("[empty label]");
+  auto label = getLabel();
+  auto labelStr = label? label->toString() : std::string("[empty label]");
   result += std::string("Label:") + labelStr;
   result += isWrite()? std::string("@write") : std::string("@read");
+  result += std::string("@mask:") + std::to_string(_byteMask);
   return result;
 }
 
 Label* Record::getLabel() const {
-  return _label? _label.get() : nullptr;
+  return getInternedLabel(_labelId);
 }
 
-LockSet* Record::getLockSet() const {
-  return _lockSet? _lockSet.get() : nullptr;
+const LockSet* Record::getLockSet() const {
+  return getInternedLockSet(_lockSetId);
 }
 
 void* Record::getInstnAddr() const {
-  return _instnAddr;
+  return getInternedSite(_siteId);
 }
 
 void* Record::getTaskPtr() const {
-  return _taskPtr;
+  return getInternedTask(_labelId);
+}
+
+uint32_t Record::getLabelId() const {
+  return _labelId;
+}
+
+uint32_t Record::getLockSetId() const {
+  return _lockSetId;
 }
 }
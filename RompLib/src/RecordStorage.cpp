@@ -0,0 +1,268 @@
+#include "RecordStorage.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <glog/logging.h>
+#include <glog/raw_logging.h>
+#include <new>
+
+#include "InternTable.h"
+
+/*
+ * Each thread carves spill buffers out of chunks of this size. Chunks are
+ * never returned to the system.
+ */
+#define SPILL_CHUNK_SIZE (64 * 1024)
+
+namespace romp {
+
+/*
+ * Per-thread slab of spill buffers. Freed buffers are pushed on the freelist
+ * of their size class. A buffer freed by a thread other than its allocating
+ * thread simply joins the freelist of the freeing thread.
+ */
+struct SpillSlab {
+  void* freeLists[NUM_SLAB_SIZE_CLASSES];
+  char* chunkCur;
+  char* chunkEnd;
+};
+
+thread_local SpillSlab tSpillSlab;
+
+static uint64_t spillCapacity(uint32_t sizeClass) {
+  return static_cast<uint64_t>(NUM_INLINE_RECORDS) << (sizeClass + 1);
+}
+
+static uint64_t spillBytes(uint32_t sizeClass) {
+  return static_cast<uint64_t>(spillCapacity(sizeClass)) * sizeof(Record);
+}
+
+static bool isSlabSizeClass(uint32_t sizeClass) {
+  return sizeClass < NUM_SLAB_SIZE_CLASSES && 
+      spillBytes(sizeClass) <= SPILL_CHUNK_SIZE;
+}
+
+/*
+ * Get a buffer of size class `sizeClass`, first from the freelist, then from
+ * the current chunk. Larger buffers are allocated directly from the heap.
+ */
+void* allocSpillBuffer(uint32_t sizeClass) {
+  auto bytes = spillBytes(sizeClass);
+  if (!isSlabSizeClass(sizeClass)) {
+    return ::operator new(bytes);
+  }
+  auto& slab = tSpillSlab;
+  auto head = slab.freeLists[sizeClass];
+  if (head) {
+    slab.freeLists[sizeClass] = *static_cast<void**>(head);
+    return head;
+  }
+  if (slab.chunkCur == nullptr ||
+      static_cast<uint64_t>(slab.chunkEnd - slab.chunkCur) < bytes) {
+    slab.chunkCur = static_cast<char*>(malloc(SPILL_CHUNK_SIZE));
+    if (!slab.chunkCur) {
+      RAW_LOG(FATAL, "cannot allocate spill chunk for access records");
+    }
+    slab.chunkEnd = slab.chunkCur + SPILL_CHUNK_SIZE;
+  }
+  auto buffer = slab.chunkCur;
+  slab.chunkCur += bytes;
+  return buffer;
+}
+
+void freeSpillBuffer(void* buffer, uint32_t sizeClass) {
+  if (!isSlabSizeClass(sizeClass)) {
+    ::operator delete(buffer);
+    return;
+  }
+  auto& slab = tSpillSlab;
+  *static_cast<void**>(buffer) = slab.freeLists[sizeClass];
+  slab.freeLists[sizeClass] = buffer;
+}
+
+RecordStorage::~RecordStorage() {
+  clear();
+}
+
+Record* RecordStorage::_data() {
+  if (_sizeClass == 0) {
+    return reinterpret_cast<Record*>(_inline);
+  }
+  return _getSpill();
+}
+
+Record* RecordStorage::_getSpill() const {
+  Record* spill;
+  memcpy(&spill, _inline, sizeof(spill));
+  return spill;
+}
+
+void RecordStorage::_setSpill(Record* spill) {
+  memcpy(_inline, &spill, sizeof(spill));
+}
+
+uint32_t RecordStorage::_capacity() const {
+  if (_sizeClass == 0) {
+    return NUM_INLINE_RECORDS;
+  }
+  return static_cast<uint32_t>(std::min(spillCapacity(_sizeClass - 1), 
+              static_cast<uint64_t>(MAX_NUM_RECORDS)));
+}
+
+/*
+ * Move all records to the storage of `sizeClass`: inline if it is 0, or a 
+ * spill buffer of class `sizeClass` - 1. The old spill buffer, if any, is 
+ * returned to the slab. The inline records share their bytes with the spill
+ * buffer pointer, so records moving inline go through a temporary.
+ */
+void RecordStorage::_relocate(uint32_t sizeClass) {
+  auto oldBuffer = _data();
+  auto oldSizeClass = _sizeClass;
+  if (sizeClass == 0) {
+    Record moved[NUM_INLINE_RECORDS];
+    for (uint32_t i = 0; i < _size; ++i) {
+      moved[i] = std::move(oldBuffer[i]);
+      oldBuffer[i].~Record();
+    }
+    _sizeClass = 0;
+    auto newBuffer = reinterpret_cast<Record*>(_inline);
+    for (uint32_t i = 0; i < _size; ++i) {
+      new (&newBuffer[i]) Record(std::move(moved[i]));
+    }
+  } else {
+    auto newBuffer = static_cast<Record*>(allocSpillBuffer(sizeClass - 1));
+    for (uint32_t i = 0; i < _size; ++i) {
+      new (&newBuffer[i]) Record(std::move(oldBuffer[i]));
+      oldBuffer[i].~Record();
+    }
+    _setSpill(newBuffer);
+    _sizeClass = sizeClass;
+  }
+  if (oldSizeClass != 0) {
+    freeSpillBuffer(oldBuffer, oldSizeClass - 1);
+  }
+}
+
+/*
+ * Move all records to a spill buffer of the next size class. Size classes
+ * are not bounded, only the record count field is.
+ */
+void RecordStorage::_grow() {
+  if (_size == MAX_NUM_RECORDS) {
+    RAW_LOG(FATAL, "too many access records: %u", 
+            static_cast<uint32_t>(_size));
+  }
+  _relocate(_sizeClass + 1);
+}
+
+Record* RecordStorage::begin() {
+  return _data();
+}
+
+Record* RecordStorage::end() {
+  return _data() + _size;
+}
+
+bool RecordStorage::empty() const {
+  return _size == 0;
+}
+
+uint32_t RecordStorage::size() const {
+  return _size;
+}
+
+/*
+ * Append a copy of `record`. Each stored record holds a reference on the 
+ * entry of its label, records moving within the storage keep theirs.
+ */
+void RecordStorage::push_back(const Record& record) {
+  if (_size == _capacity()) {
+    _grow();
+  }
+  retainLabelEntry(record.getLabelId());
+  new (_data() + _size) Record(record);
+  _size++;
+}
+
+/*
+ * Erase the record pointed by `it` and keep the order of remaining records.
+ * Return pointer to the record following the erased one.
+ */
+Record* RecordStorage::erase(Record* it) {
+  releaseLabelEntry(it->getLabelId());
+  auto last = end() - 1;
+  for (auto cur = it; cur != last; ++cur) {
+    *cur = std::move(*(cur + 1));
+  }
+  last->~Record();
+  _size--;
+  return it;
+}
+
+/*
+ * Take an unlocked look at the records for an optimistic reader. The result
+ * is only meaningful if the reader validates its read afterwards. Return
+ * false if the records live in a buffer that may be returned to the system
+ * while being read; buffers carved out of chunks stay readable.
+ */
+bool RecordStorage::peek(const Record*& data, uint32_t& size) const {
+  auto sizeClass = _sizeClass;
+  if (sizeClass == 0) {
+    data = reinterpret_cast<const Record*>(_inline);
+    size = std::min(static_cast<uint32_t>(_size), 
+            static_cast<uint32_t>(NUM_INLINE_RECORDS));
+    return true;
+  }
+  if (!isSlabSizeClass(sizeClass - 1)) {
+    return false;
+  }
+  data = _getSpill();
+  size = std::min(static_cast<uint32_t>(_size), 
+          static_cast<uint32_t>(spillCapacity(sizeClass - 1)));
+  return true;
+}
+
+/*
+ * Destroy all records and return the spill buffer to the slab. The storage
+ * goes back to the inline state and the label entries of the records are
+ * released.
+ */
+void RecordStorage::clear() {
+  auto data = _data();
+  for (uint32_t i = 0; i < _size; ++i) {
+    releaseLabelEntry(data[i].getLabelId());
+    data[i].~Record();
+  }
+  if (_sizeClass != 0) {
+    freeSpillBuffer(data, _sizeClass - 1);
+  }
+  _size = 0;
+  _sizeClass = 0;
+}
+
+/*
+ * Move the records to smaller storage once at most a quarter of the spill
+ * buffer is used, and return the buffer to the slab. Stale records swept out
+ * of a long history would otherwise pin a large spill buffer for good. The
+ * records go inline if they fit, otherwise to the smallest size class that
+ * is at most half full. Shrinking only well below the capacity keeps a 
+ * history whose size goes back and forth around a class boundary from 
+ * moving its records on every access.
+ */
+void RecordStorage::shrink() {
+  if (_sizeClass == 0 || 
+      static_cast<uint64_t>(_size) * 4 > _capacity()) {
+    return;
+  }
+  uint32_t sizeClass = 0;
+  if (_size > NUM_INLINE_RECORDS) {
+    sizeClass = 1;
+    while (spillCapacity(sizeClass - 1) < static_cast<uint64_t>(_size) * 2) {
+      sizeClass++;
+    }
+  }
+  _relocate(sizeClass);
+}
+
+}
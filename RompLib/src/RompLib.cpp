@@ -1,17 +1,22 @@
+#include <algorithm>
 #include <filesystem>
 #include <glog/logging.h>
 #include <glog/raw_logging.h>
 #include <limits.h>
 #include <unistd.h>
 
+#include "AccessDedup.h"
+#include "AccessFilter.h"
 #include "AccessHistory.h"
 #include "Core.h"
 #include "CoreUtil.h"
 #include "DataSharing.h"
 #include "Initialize.h"
+#include "InternTable.h"
 #include "Label.h"
 #include "LockSet.h"
 #include "ShadowMemory.h"
+#include "TaskContext.h"
 #include "TaskData.h"
 #include "ThreadData.h"
 
@@ -19,91 +24,184 @@ namespace fs = std::filesystem;
 
 namespace romp {
 
-using LabelPtr = std::shared_ptr<Label>;
-using LockSetPtr = std::shared_ptr<LockSet>;
-
-ShadowMemory<AccessHistory> shadowMemory;
+RompShadowMemory<AccessHistory> shadowMemory(20, 12, 48, eLongWordLevel);
 
 /*
- * Driver function to do data race checking and access history management.
+ * Return true if the current access is redundant: either data races have 
+ * been reported on all bytes it touches, or every byte is covered by a 
+ * history record of the same label that is at least as strong, i.e., a write
+ * or a read by a read, under a subset of the current lock set. Such an access
+ * can neither find a new data race nor change what future accesses find.
+ * The access history is read without holding its lock. The result is only 
+ * trusted if no writer modified the history in the meantime, otherwise false
+ * is returned and the caller takes the locked path.
  */
-void checkDataRace(AccessHistory* accessHistory, const LabelPtr& curLabel, 
-                   const LockSetPtr& curLockSet, const CheckInfo& checkInfo) {
-  McsNode node;
-  LockGuard guard(&(accessHistory->getLock()), &node);
-  if (checkInfo.hwLock) {
-    return;
+bool accessIsRedundant(const AccessHistory* accessHistory, 
+                       uint32_t curLabelId, 
+                       uint32_t curLockSetId,
+                       const CheckInfo& checkInfo) {
+  auto version = accessHistory->beginOptimisticRead();
+  if (version & SYNC_LOCK_BIT) {
+    return false;
   }
-  auto dataSharingType = checkInfo.dataSharingType;
-  if (dataSharingType == eThreadPrivateBelowExit || 
-          dataSharingType == eStaticThreadPrivate) {
-    return;
+  if (accessHistory->memIsRecycled() || 
+      accessHistory->getGeneration() < checkInfo.generation ||
+      accessHistory->getGeneration() < checkInfo.pruneGeneration) {
+    // the history has to be reset
+    return false;
   }
-  auto records = accessHistory->getRecords();
-  if (accessHistory->dataRaceFound()) {
-    /* 
-     * data race has already been found on this memory location, romp only 
-     * reports one data race on any memory location in one run. Once the data 
-     * race is reported, romp clears the access history with respect to this
-     * memory location and mark this memory location as found. Future access 
-     * to this memory location does not go through data race checking.
-     */
-    if (!records->empty()) {
-      records->clear();
+  auto uncoveredMask = static_cast<uint8_t>(checkInfo.byteMask & 
+          ~accessHistory->getDataRaceMask());
+  const Record* records;
+  uint32_t numRecords = 0;
+  if (uncoveredMask != 0) {
+    if (!accessHistory->getRecords()->peek(records, numRecords)) {
+      return false;
+    }
+    // the records pointer must be consistent before it is dereferenced
+    if (!accessHistory->validateOptimisticRead(version)) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < numRecords && uncoveredMask != 0; ++i) {
+    auto histRecord = records[i];
+    if (histRecord.getLabelId() == curLabelId &&
+        (histRecord.isWrite() || !checkInfo.isWrite) &&
+        (histRecord.getLockSetId() == NULL_INTERN_ID || 
+         histRecord.getLockSetId() == curLockSetId)) {
+      uncoveredMask &= ~histRecord.getByteMask();
     }
+  }
+  return uncoveredMask == 0 && 
+      accessHistory->validateOptimisticRead(version);
+}
+
+/*
+ * Driver function to do data race checking and access history management.
+ * One access history slot covers an aligned granule of bytes. The bytes of 
+ * the granule touched by the current access are given by checkInfo.byteMask.
+ * History records whose byte mask does not overlap with the current access
+ * are not related to the current access and are skipped.
+ */
+void checkDataRace(AccessHistory* accessHistory, uint32_t curLabelId, 
+                   uint32_t curLockSetId, const CheckInfo& checkInfo) {
+  if (accessIsRedundant(accessHistory, curLabelId, curLockSetId, checkInfo)) {
     return;
   }
-  if (accessHistory->memIsRecycled()) {
+  HistoryWriteGuard guard(accessHistory);
+  auto records = accessHistory->getRecords();
+  auto validGeneration = std::max(checkInfo.generation, 
+          checkInfo.pruneGeneration);
+  if (accessHistory->memIsRecycled() || 
+      accessHistory->getGeneration() < checkInfo.generation) {
     /*
-     * The memory slot is recycled because of the end of explicit task. 
-     * reset the memory state flag and clear the access records.
+     * The memory slot is recycled because of the end of explicit task, 
+     * either marked directly or by invalidating the range of shadow memory
+     * containing it. Reset the memory state and clear the access records.
+     * The current access is the first access to the recycled memory.
      */
      accessHistory->clearFlags();
+     accessHistory->setGeneration(validGeneration);
+     records->clear();
+  } else if (accessHistory->getGeneration() < checkInfo.pruneGeneration) {
+    /*
+     * All records were made before the end of the last outermost parallel
+     * region and happen before the current access. Drop them, but keep the
+     * bytes with reported data races as the memory is not recycled.
+     */
+     accessHistory->setGeneration(validGeneration);
      records->clear();
-     return;
   }
-  auto curRecord = Record(checkInfo.isWrite, curLabel, curLockSet, 
-          checkInfo.taskPtr, checkInfo.instnAddr);
+  /* 
+   * data race has already been found on some bytes of this memory location,
+   * romp only reports one data race on any memory location in one run. Once 
+   * the data race is reported, romp removes these bytes from the access 
+   * history and marks them as found. Future access to these bytes does not 
+   * go through data race checking.
+   */
+  auto curByteMask = static_cast<uint8_t>(checkInfo.byteMask & 
+          ~accessHistory->getDataRaceMask());
+  if (curByteMask == 0) {
+    return;
+  }
+  auto curRecord = Record(checkInfo.isWrite, curLabelId, curLockSetId, 
+          checkInfo.siteId, curByteMask);
   if (records->empty()) {
     // no access record, add current access to the record
     records->push_back(curRecord);
-  } else {
-    // check previous access records with current access
-    auto isHistBeforeCurrent = false;
-    auto it = records->begin();
-    std::vector<Record>::const_iterator cit;
-    auto skipAddCur = false;
-    int diffIndex;
-    while (it != records->end()) {
-      cit = it; 
-      auto histRecord = *cit;
-      if (analyzeRaceCondition(histRecord, curRecord, isHistBeforeCurrent, 
-                  diffIndex)) {
-        gDataRaceFound = true;
-        gNumDataRace++;
-        if (gReportLineInfo) {
-          McsNode node;	
-          LockGuard recordGuard(&gDataRaceLock, &node);
-          gDataRaceRecords.push_back(DataRaceInfo(histRecord.getInstnAddr(),
-                                                  curRecord.getInstnAddr(),
-                                                  checkInfo.byteAddress));
-        } else if (gReportAtRuntime) {
-          reportDataRace(histRecord.getInstnAddr(), curRecord.getInstnAddr(),
-                         checkInfo.byteAddress);
-        }
-        accessHistory->setFlag(eDataRaceFound);  
-      }
-      auto decision = manageAccessRecord(histRecord, curRecord, 
-              isHistBeforeCurrent, diffIndex);
-      if (decision == eSkipAddCur) {
-        skipAddCur = true;
+    accessHistory->setOwner(checkInfo.ownerId);
+    return;
+  } 
+  /*
+   * If the access history is exclusive to the ownership epoch of the current
+   * task, all records happen before the current access. Only the records
+   * need to be managed, the label based race analysis is skipped. The same
+   * holds for a record left by the same team before a barrier that the
+   * current task has passed. Such stale records are swept when touched.
+   */
+  auto isExclusive = accessHistory->getOwner() == checkInfo.ownerId;
+  // check previous access records with current access
+  auto isHistBeforeCurrent = false;
+  auto it = records->begin();
+  const Record* cit;
+  uint8_t skipAddMask = 0;
+  uint8_t dataRaceMask = 0;
+  int diffIndex;
+  while (it != records->end()) {
+    cit = it; 
+    auto histRecord = *cit;
+    auto overlapMask = static_cast<uint8_t>(histRecord.getByteMask() & 
+            curByteMask);
+    if (overlapMask == 0) {
+      it++;
+      continue;
+    }
+    if (isExclusive || isOrderedByBarrier(histRecord.getLabelId(),
+                curLabelId)) {
+      isHistBeforeCurrent = true;
+      diffIndex = histRecord.getLabelId() == curLabelId ? 
+          static_cast<int>(eSameLabel) : 0;
+    } else if (analyzeRaceCondition(histRecord, curRecord, 
+                isHistBeforeCurrent, diffIndex)) {
+      gDataRaceFound = true;
+      // keep counting data races per byte
+      gNumDataRace += __builtin_popcount(overlapMask);
+      auto raceAddress = checkInfo.byteAddress + __builtin_ctz(overlapMask);
+      if (gReportLineInfo) {
+        McsNode node;	
+        LockGuard recordGuard(&gDataRaceLock, &node);
+        gDataRaceRecords.push_back(DataRaceInfo(histRecord.getInstnAddr(),
+                                                curRecord.getInstnAddr(),
+                                                raceAddress));
+      } else if (gReportAtRuntime) {
+        reportDataRace(histRecord.getInstnAddr(), curRecord.getInstnAddr(),
+                       raceAddress);
       }
-      modifyAccessHistory(decision, records, it);
+      dataRaceMask |= overlapMask;
     }
-    if (!skipAddCur) {
-      records->push_back(curRecord); 
+    auto decision = manageAccessRecord(histRecord, curRecord, 
+            isHistBeforeCurrent, diffIndex);
+    if (decision == eSkipAddCur) {
+      skipAddMask |= overlapMask;
     }
+    modifyAccessHistory(decision, records, it, curByteMask);
   }
+  if (records->empty()) {
+    // all history records are superseded by the current access
+    accessHistory->setOwner(checkInfo.ownerId);
+  } else if (!isExclusive) {
+    accessHistory->setOwner(NULL_INTERN_ID);
+  }
+  curRecord.clearBytes(skipAddMask);
+  if (curRecord.getByteMask() != 0) {
+    summarizeReads(records, curRecord);
+    records->push_back(curRecord); 
+  }
+  if (dataRaceMask != 0) {
+    accessHistory->setDataRaceMask(dataRaceMask);
+    clearRecordBytes(records, dataRaceMask);
+  }
+  records->shrink();
 }
 
 extern "C" {
@@ -145,22 +243,19 @@ void checkAccess(void* address,
     //RAW_LOG(INFO, "ompt not initialized yet");
     return;
   }
-  AllTaskInfo allTaskInfo;
-  int threadNum = -1;
-  int taskType = -1;
-  int teamSize = -1;
-  void* curThreadData = nullptr;
-  void* curParRegionData = nullptr;
-  if (!prepareAllInfo(taskType, teamSize, threadNum, curParRegionData, 
-              curThreadData, allTaskInfo)) {
+  // the context is maintained by callbacks, no runtime query is needed here
+  auto context = getTaskContext();
+  if (!context) {
     return;
   }
+  auto taskType = context->taskType;
   if (taskType == ompt_task_initial) { 
     // don't check data race for initial task
     return;
   }
+  auto allTaskInfo = context->allTaskInfo;
   // query data  
-  auto dataSharingType = analyzeDataSharing(curThreadData, address, 
+  auto dataSharingType = analyzeDataSharing(context->threadData, address, 
                                            allTaskInfo.taskFrame);
   if (!allTaskInfo.taskData->ptr) {
     RAW_LOG(WARNING, "pointer to current task data is null");
@@ -168,17 +263,47 @@ void checkAccess(void* address,
   }
   auto curTaskData = static_cast<TaskData*>(allTaskInfo.taskData->ptr);
   curTaskData->exitFrame = allTaskInfo.taskFrame->exit_frame.ptr;
-  auto& curLabel = curTaskData->label;
-  auto& curLockSet = curTaskData->lockSet;
+  if (filterAccess(hwLock, dataSharingType)) {
+    // the access can not race, don't touch the shadow memory
+    return;
+  }
+  /*
+   * Intern the current label, lock set and instruction address once for the
+   * whole access. Records refer to them by id.
+   */
+  auto curLabelId = internTaskLabel(curTaskData);
+  auto curLockSetId = internLockSet(curTaskData->lockSet);
   
   CheckInfo checkInfo(allTaskInfo, bytesAccessed, instnAddr, 
           static_cast<void*>(curTaskData), taskType, isWrite, hwLock, 
           dataSharingType);
-  for (uint64_t i = 0; i < bytesAccessed; ++i) {
-    auto curAddress = reinterpret_cast<uint64_t>(address) + i;      
-    auto accessHistory = shadowMemory.getShadowMemorySlot(curAddress);
-    checkInfo.byteAddress = curAddress;
-    checkDataRace(accessHistory, curLabel, curLockSet, checkInfo);
+  checkInfo.siteId = internSite(instnAddr);
+  checkInfo.ownerId = getTaskOwnerId(curTaskData);
+  /*
+   * Check the access once per shadow granule instead of once per byte. An 
+   * aligned access within one granule is checked once, an unaligned access
+   * touches at most two granules.
+   */
+  auto granuleSize = shadowMemory.getGranuleSize();
+  auto curAddress = reinterpret_cast<uint64_t>(address);
+  auto endAddress = curAddress + bytesAccessed;
+  while (curAddress < endAddress) {
+    auto granuleBase = curAddress & ~(granuleSize - 1);
+    auto granuleEnd = std::min(granuleBase + granuleSize, endAddress);
+    auto byteMask = computeByteMask(curAddress - granuleBase, 
+            granuleEnd - curAddress);
+    if (accessIsDuplicate(granuleBase, byteMask, isWrite, curLabelId, 
+                curLockSetId, curTaskData->inReduction)) {
+      // already checked in the current interval, skip the shadow memory
+      curAddress = granuleEnd;
+      continue;
+    }
+    auto accessHistory = shadowMemory.getShadowMemorySlot(curAddress, 
+            checkInfo.generation, checkInfo.pruneGeneration);
+    checkInfo.byteAddress = granuleBase;
+    checkInfo.byteMask = byteMask;
+    checkDataRace(accessHistory, curLabelId, curLockSetId, checkInfo);
+    curAddress = granuleEnd;
   }
 }
 
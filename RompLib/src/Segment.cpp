@@ -17,6 +17,7 @@
 #define WORKSHARE_TYPE_MASK  0x0000000000000004
 #define TASKWAIT_SYNC_MASK   0x0000000000000008
 #define TASKGROUP_SYNC_MASK  0x0000000000000010
+#define SYNC_MARK_MASK       (TASKWAIT_SYNC_MASK | TASKGROUP_SYNC_MASK)
 
 #define TASKGROUP_ID_MASK    0x00000000ffff0000
 #define TASKGROUP_LEVEL_MASK 0x000000000000ffff
@@ -56,9 +57,12 @@ namespace romp {
  * [0,31]: work share id
  * [62,63]: single construct flag bits 
  */
-std::string BaseSegment::toString() const {
+std::string Segment::toString() const {
   std::stringstream stream;
-  if (_taskGroup == 0) {
+  if (getType() == eWorkShare) {
+    stream << std::hex << std::setw(16) << std::setfill('0') << _value << 
+      "ws:" << std::setw(16) << std::setfill('0') << _workShareId;
+  } else if (_taskGroup == 0) {
     stream << std::hex << std::setw(16) << std::setfill('0') << _value;
   } else if (_orderSecVal == 0) {
     stream << std::hex << std::setw(16) << std::setfill('0') << _value << 
@@ -71,31 +75,39 @@ std::string BaseSegment::toString() const {
   return "[" + stream.str() + "]";
 }
 
-BaseSegment::BaseSegment(SegmentType type, uint64_t offset, 
+Segment::Segment(SegmentType type, uint64_t offset, 
         uint64_t span) {
   RAW_CHECK(span < (1 << OFFSET_SPAN_WIDTH), "span is overflowing");
   _value = 0;
+  _workShareId = 0;
   _taskGroup = 0;
   _orderSecVal = 0;
   setType(type);
   setOffsetSpan(offset, span);
 }
 
-std::shared_ptr<Segment> BaseSegment::clone() const {
-  return std::make_shared<BaseSegment>(*this);
+/*
+ * Construct a workshare segment for the dispatched iteration or section 
+ * identified by `workShareId`.
+ */
+Segment::Segment(uint64_t workShareId, bool isSection): _value(0), 
+    _workShareId(workShareId), _taskGroup(0), _orderSecVal(0) {
+  setType(eWorkShare);
+  setWorkShareType(isSection);
+  setOffsetSpan(0, 1);
 }
 
-uint64_t BaseSegment::getValue() const {
+uint64_t Segment::getValue() const {
   return _value;
 }
 
-void BaseSegment::setOffsetSpan(uint64_t offset, uint64_t span) {
+void Segment::setOffsetSpan(uint64_t offset, uint64_t span) {
   _value &= ~(OFFSET_MASK | SPAN_MASK);  // clear the offset, span field
   _value |= (offset << OFFSET_SHIFT) & OFFSET_MASK; 
   _value |= (span << SPAN_SHIFT) & SPAN_MASK; 
 }
 
-void BaseSegment::getOffsetSpan(uint64_t& offset, uint64_t& span) const {
+void Segment::getOffsetSpan(uint64_t& offset, uint64_t& span) const {
   offset = (_value & OFFSET_MASK) >> OFFSET_SHIFT;
   span = (_value & SPAN_MASK) >> SPAN_SHIFT;
 }
@@ -104,11 +116,11 @@ void BaseSegment::getOffsetSpan(uint64_t& offset, uint64_t& span) const {
  * Taskgroup id increases monotonically. It is at the upper half of the
  * 32 bits _taskGroup value
  */
-uint16_t BaseSegment::getTaskGroupId() const {
+uint16_t Segment::getTaskGroupId() const {
   return static_cast<uint16_t>(_taskGroup >> 16);
 }
                                    
-void BaseSegment::setTaskGroupId(uint16_t taskGroupId) {
+void Segment::setTaskGroupId(uint16_t taskGroupId) {
   _taskGroup = static_cast<uint32_t>(
           static_cast<uint64_t>(_taskGroup) & ~TASKGROUP_ID_MASK);
   _taskGroup |= static_cast<uint32_t>(
@@ -121,7 +133,7 @@ void BaseSegment::setTaskGroupId(uint16_t taskGroupId) {
  * happens-before relation when ordered section is involed. Store the phase at 
  * the upper half of the 32 bit _orderSecVal.
  */
-void BaseSegment::setTaskGroupPhase(uint16_t phase) {
+void Segment::setTaskGroupPhase(uint16_t phase) {
   _orderSecVal = static_cast<uint32_t>(
          static_cast<uint64_t>(_orderSecVal) & TASKGROUP_PHASE_MASK); 
   _orderSecVal |= static_cast<uint32_t>(
@@ -133,14 +145,14 @@ void BaseSegment::setTaskGroupPhase(uint16_t phase) {
  * the ordered section phase. Store the phase at the lower half of the 32 bit
  * _orderSecVal.
  */
-void BaseSegment::setTaskwaitPhase(uint16_t phase) {
+void Segment::setTaskwaitPhase(uint16_t phase) {
   _orderSecVal = static_cast<uint32_t>(
           static_cast<uint64_t>(_orderSecVal) & TASKWAIT_PHASE_MASK);
   _orderSecVal |= static_cast<uint32_t>(
           (static_cast<uint64_t>(phase) & TASKWAIT_PHASE_MASK));
 }
 
-uint16_t BaseSegment::getTaskwaitPhase() const {
+uint16_t Segment::getTaskwaitPhase() const {
   return static_cast<uint16_t>(
       static_cast<uint64_t>(_orderSecVal) & TASKWAIT_PHASE_MASK);
 }
@@ -149,7 +161,7 @@ uint16_t BaseSegment::getTaskwaitPhase() const {
  * Taskgroup level marks the nested number of level of taskgorup. 
  * It is the lower 16 bits of the 32 bits long word _taskGroup
  */
-uint16_t BaseSegment::getTaskGroupLevel() const {
+uint16_t Segment::getTaskGroupLevel() const {
   return static_cast<uint16_t>(
           static_cast<uint64_t>(_taskGroup) & TASKGROUP_LEVEL_MASK); 
 }
@@ -158,93 +170,106 @@ uint16_t BaseSegment::getTaskGroupLevel() const {
  * Task group phase records the phase of the workshare task, if applicable,
  * as the task encounters the taskgroup start/end point.
  */
-uint16_t BaseSegment::getTaskGroupPhase() const {
+uint16_t Segment::getTaskGroupPhase() const {
   return static_cast<uint16_t>((_taskGroup & TASKGROUP_PHASE_MASK) >> 16);
 }
 
-void BaseSegment::setTaskwaited() {
+void Segment::setTaskwaited() {
   _value |= TASKWAIT_SYNC_MASK; 
 }
 
-bool BaseSegment::isTaskwaited() const {
+bool Segment::isTaskwaited() const {
   return (_value & TASKWAIT_SYNC_MASK) != 0;
 }
 
-void BaseSegment::setTaskGroupSync() { 
+void Segment::setTaskGroupSync() { 
   _value |= TASKGROUP_SYNC_MASK;
 }
 
-bool BaseSegment::isTaskGroupSync() const {
+bool Segment::isTaskGroupSync() const {
   return (_value & TASKGROUP_SYNC_MASK) != 0;
 }
 
-void BaseSegment::setTaskGroupLevel(uint16_t taskGroupLevel) {
+void Segment::setTaskGroupLevel(uint16_t taskGroupLevel) {
   _taskGroup = static_cast<uint32_t>(
           static_cast<uint64_t>(_taskGroup) & ~TASKGROUP_LEVEL_MASK);
   _taskGroup |= static_cast<uint32_t>(
           static_cast<uint64_t>(taskGroupLevel) & TASKGROUP_LEVEL_MASK);
 }
 
-bool BaseSegment::operator==(const Segment& segment) const {
-  return _value == dynamic_cast<const BaseSegment&>(segment)._value;
+/*
+ * The segment value without the taskwait/taskgroup sync marks. Sync marks and
+ * the recorded ordered section phases are set on a segment after it becomes 
+ * part of a label, so they are not part of the key that identifies labels.
+ */
+uint64_t Segment::getKeyValue() const {
+  return _value & ~SYNC_MARK_MASK;
+}
+
+uint64_t Segment::getKeyHash() const {
+  return getKeyValue() ^ (static_cast<uint64_t>(_taskGroup) << 7) ^
+      (_workShareId * 0x9e3779b97f4a7c15);
 }
 
-bool BaseSegment::operator!=(const Segment& segment) const {
-  return !(*this == segment);
+bool Segment::hasSameKey(const Segment& segment) const {
+  return getKeyValue() == segment.getKeyValue() && 
+      _workShareId == segment._workShareId &&
+      _taskGroup == segment._taskGroup;
 }
+
 /*
  * Taskwait field is four bits. So if taskwait is more than 16, it overflows.
  */
-void BaseSegment::setTaskwait(uint64_t taskwait) {
+void Segment::setTaskwait(uint64_t taskwait) {
   RAW_CHECK(taskwait < 16, "taskwait count is overflowing");
   _value &= TASKWAIT_MASK; // clear the taskwait field
   _value |= (taskwait << TASKWAIT_SHIFT) & ~TASKWAIT_MASK;
 }
 
-uint64_t BaseSegment::getTaskwait() const {
+uint64_t Segment::getTaskwait() const {
   uint64_t taskwait = (_value & ~TASKWAIT_MASK) >> TASKWAIT_SHIFT;
   return taskwait;
 }
 
-void BaseSegment::setTaskcreate(uint64_t taskcreate) { 
+void Segment::setTaskcreate(uint64_t taskcreate) { 
   RAW_CHECK(taskcreate < (1 << 15), "taskcreate count is overflowing");
   _value &= ~TASK_CREATE_MASK;
   _value |= (taskcreate << TASK_CREATE_SHIFT) & TASK_CREATE_MASK;
 }
 
-uint64_t BaseSegment::getTaskcreate() const {
+uint64_t Segment::getTaskcreate() const {
   uint64_t taskcreate = (_value & TASK_CREATE_MASK) >> TASK_CREATE_SHIFT;
   return taskcreate;
 }
 
-void BaseSegment::setPhase(uint64_t phase) {
+void Segment::setPhase(uint64_t phase) {
   RAW_CHECK(phase < 16, "phase count is overflowing");
   _value &= ~PHASE_MASK;
   _value |= (phase << PHASE_SHIFT) & PHASE_MASK;
 
 }
 
-uint64_t BaseSegment::getPhase() const {
+uint64_t Segment::getPhase() const {
   uint64_t phase = (_value & PHASE_MASK) >> PHASE_SHIFT;
   return phase;
 }
 
-void BaseSegment::setLoopCount(uint64_t loopCount) {
+void Segment::setLoopCount(uint64_t loopCount) {
   RAW_CHECK(loopCount < 16, "loop count is overflowing");
   _value &= ~LOOP_CNT_MASK;
   _value |= (loopCount << LOOP_CNT_SHIFT) & LOOP_CNT_MASK;
 }
 
-uint64_t BaseSegment::getLoopCount() const {
+uint64_t Segment::getLoopCount() const {
   uint64_t loopCount = (_value & LOOP_CNT_MASK) >> LOOP_CNT_SHIFT;
   return loopCount;
 }
 
-void BaseSegment::setType(SegmentType type) {
+void Segment::setType(SegmentType type) {
   _value |= static_cast<uint64_t>(type);
 }
 
-SegmentType BaseSegment::getType() const {
+SegmentType Segment::getType() const {
   auto mask = _value & SEG_TYPE_MASK;
   switch(mask) {
     case 0x1:
@@ -258,24 +283,11 @@ SegmentType BaseSegment::getType() const {
   return eError;
 }
 
-std::string WorkShareSegment::toString() const {
-  std::stringstream stream;
-  auto baseResult = BaseSegment::toString();
-  stream << "ws:" << std::hex << std::setw(16) << std::setfill('0') << 
-      _workShareId;
-  auto result = "[" + baseResult + stream.str() + "]";
-  return result;
-}
-
-std::shared_ptr<Segment> WorkShareSegment::clone() const {
-  return std::make_shared<WorkShareSegment>(*this);
-}
-
 /*
  * Set place holder flag for the workshare segment. If toggle is true,
  * set the flag, otherwise, clear the flag.
  */
-void WorkShareSegment::setPlaceHolderFlag(bool toggle) {
+void Segment::setPlaceHolderFlag(bool toggle) {
   if (toggle) {
     _value |= (1 << WS_PLACE_HOLDER_POS);
   } else {
@@ -283,36 +295,23 @@ void WorkShareSegment::setPlaceHolderFlag(bool toggle) {
   }
 }
 
-bool WorkShareSegment::operator==(const Segment& segment) const {
-  if (_value == dynamic_cast<const BaseSegment&>(segment).getValue()) {
-    // we know `segment` is also a workshare segment
-    return _workShareId == 
-        dynamic_cast<const WorkShareSegment&>(segment)._workShareId;
-  } 
-  return false;
-}
-
-bool WorkShareSegment::operator!=(const Segment& segment) const {
-  return !(*this == segment);
-}
-
-bool WorkShareSegment::isPlaceHolder() const {
+bool Segment::isPlaceHolder() const {
   return ((_value & ~WS_PLACE_HOLDER_MASK) >> WS_PLACE_HOLDER_POS) == 1;
 }
 
-bool WorkShareSegment::isSingleExecutor() const {
+bool Segment::isSingleExecutor() const {
   return ((_workShareId & SINGLE_MASK) >> SINGLE_EXEC_SHIFT) == 1;
 }
 
-bool WorkShareSegment::isSingleOther() const {
+bool Segment::isSingleOther() const {
   return ((_workShareId & SINGLE_MASK) >> SINGLE_OTHER_SHIFT) == 1;
 }
 
-uint64_t WorkShareSegment::getWorkShareId() const {
+uint64_t Segment::getWorkShareId() const {
   return _workShareId;
 }
 
-void WorkShareSegment::setSingleFlag(bool isExecutor) {
+void Segment::setSingleFlag(bool isExecutor) {
   _workShareId &= ~SINGLE_MASK;
   uint64_t b = 1;
   if (isExecutor) {
@@ -324,16 +323,15 @@ void WorkShareSegment::setSingleFlag(bool isExecutor) {
   }
 }
 
-void WorkShareSegment::setWorkShareType(bool isSection) {
+void Segment::setWorkShareType(bool isSection) {
   _value &= ~WORKSHARE_TYPE_MASK; // clear the bit first
   if (isSection) {
     _value |= WORKSHARE_TYPE_MASK;  // set the bit
   } 
 }
 
-bool WorkShareSegment::isSection() const {
+bool Segment::isSection() const {
   return (_value & WORKSHARE_TYPE_MASK) != 0;
 }
 
-
 }
@@ -0,0 +1,60 @@
+#include "TaskContext.h"
+
+#include <glog/logging.h>
+#include <glog/raw_logging.h>
+
+#include "CoreUtil.h"
+
+namespace romp {
+
+thread_local TaskContext tTaskContext;
+
+/*
+ * Query the runtime for the context of the current task and cache it. Return
+ * false and leave the context invalid if core information is not available.
+ */
+bool refreshTaskContext() {
+  auto& context = tTaskContext;
+  if (!prepareAllInfo(context.taskType, context.teamSize, context.threadNum,
+              context.parRegionData, context.threadData,
+              context.allTaskInfo)) {
+    context.valid = false;
+    return false;
+  }
+  context.valid = true;
+  return true;
+}
+
+/*
+ * Debug mode check enabled by VALIDATE_TASK_CONTEXT. Query the runtime and
+ * abort if the cached context differs from the actual context, which means
+ * some callback that changes the context does not invalidate it.
+ */
+void validateTaskContext() {
+  const auto& context = tTaskContext;
+  AllTaskInfo allTaskInfo;
+  int taskType = -1;
+  int teamSize = -1;
+  int threadNum = -1;
+  void* parRegionData = nullptr;
+  void* threadData = nullptr;
+  if (!prepareAllInfo(taskType, teamSize, threadNum, parRegionData,
+              threadData, allTaskInfo)) {
+    RAW_LOG(FATAL, "task context is cached but runtime info is not available");
+    return;
+  }
+  if (taskType != context.taskType || teamSize != context.teamSize ||
+      threadNum != context.threadNum ||
+      parRegionData != context.parRegionData ||
+      threadData != context.threadData ||
+      allTaskInfo.taskData != context.allTaskInfo.taskData ||
+      allTaskInfo.taskFrame != context.allTaskInfo.taskFrame ||
+      allTaskInfo.parallelData != context.allTaskInfo.parallelData) {
+    RAW_LOG(FATAL, "stale task context: cached task %p type %d thread %d, "
+            "actual task %p type %d thread %d",
+            context.allTaskInfo.taskData, context.taskType, context.threadNum,
+            allTaskInfo.taskData, taskType, threadNum);
+  }
+}
+
+}
@@ -0,0 +1,67 @@
+#include "TaskData.h"
+
+#include "InternTable.h"
+#include "SlabAllocator.h"
+
+namespace romp {
+
+/*
+ * Task data is referenced by the runtime until the task completes, and an
+ * explicit task is referenced by its parent as well until the parent syncs
+ * with it at a taskwait or at the end of a taskgroup. Access records do not
+ * point to task data, they find what they need in the label intern table.
+ * A label entry of a task outlives it as long as access records carry its
+ * id, the entry is released together with the last such record.
+ */
+void retainTaskData(TaskData* taskData) {
+  taskData->refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+ * Record `child` as an explicit child of the task created in the taskgroup 
+ * `groupKey`, the parent holds a reference on it until they sync. Children 
+ * are mostly created in the innermost taskgroup, whose bucket is the last.
+ */
+void addExpChildTask(TaskData* taskData, TaskData* child, uint64_t groupKey) {
+  auto bucket = findExpChildBucket(taskData, groupKey);
+  if (!bucket) {
+    taskData->childExpTaskBuckets.push_back(ChildTaskBucket{groupKey, {}});
+    bucket = &taskData->childExpTaskBuckets.back();
+  }
+  bucket->children.push_back(static_cast<void*>(child));
+  retainTaskData(child);
+}
+
+/*
+ * Return the bucket of children of the task created in the taskgroup 
+ * `groupKey`, nullptr if there is none.
+ */
+ChildTaskBucket* findExpChildBucket(TaskData* taskData, uint64_t groupKey) {
+  auto& buckets = taskData->childExpTaskBuckets;
+  for (auto it = buckets.rbegin(); it != buckets.rend(); ++it) {
+    if (it->groupKey == groupKey) {
+      return &(*it);
+    }
+  }
+  return nullptr;
+}
+
+/*
+ * Drop one reference of the task data. The last reference frees it, along
+ * with the parent references held on children the task never synced with
+ * and the reference held on the entry of its last interned label.
+ */
+void releaseTaskData(TaskData* taskData) {
+  if (taskData->refCount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  for (const auto& bucket : taskData->childExpTaskBuckets) {
+    for (const auto& child : bucket.children) {
+      releaseTaskData(static_cast<TaskData*>(child));
+    }
+  }
+  releaseLabelEntry(taskData->labelId);
+  slabDelete(taskData);
+}
+
+}
@@ -2,122 +2,459 @@
 
 #include <glog/logging.h>
 #include <glog/raw_logging.h>
+#include <algorithm>
+#include <atomic>
 #include <stack>
 
 #include "TaskData.h"
 
 namespace romp {
 
+static uint64_t hashVariable(int parentId, void* variable) {
+  return (reinterpret_cast<uint64_t>(variable) ^ 
+          (static_cast<uint64_t>(parentId) << 48)) * 0x9e3779b97f4a7c15;
+}
+
 /*
- * Given a task referred to by taskPtr, register its dependence in _deps
- * _deps is a map that takes the variable address as the key. The value is 
- * a vector of (taskPtr, dependence type) pair. Each time a new dependence
- * is added to the _deps, it looks up all pairs in the corresponding vector 
- * using the variable as a key, find tasks that are generated before current
- * task (sibling tasks) and update the task graph edge depending on
- * the dependence type: 
- *  a. 'in': for any task with dependence type 'mutexinoutset', 'out', 'inout', 
- *      add an adge from that task to current task
- *  b. 'out' and 'inout': for any task with dependence type 'in', 'out', 
- *      'inout', 'mutexinoutset', add an edge from that task to current task
- *  c.  'mutexinoutset': for any task with dependence type 'in', 'out', 
- *       'inout', add an edge from that task to current task; for any task 
- *       dependence type 'mutexinoutset', form a pair of mutual exclusion task
+ * Given a task referred to by taskData, advance the frontier of each of its
+ * dependence variables among its siblings under the lock of the shard of 
+ * the variable. Siblings are created one after another by their parent, so
+ * their local ids grow in creation order. The edges from the frontiers to 
+ * the task are then added to the reachability index in one write section
+ * of the seqlock. Readers' edges are added before writers' ones, which they
+ * imply.
  */
-void TaskDepGraph::addDeps(const ompt_dependence_t& deps,  void* taskPtr) {
-  // dependence variable is stored in ptr field
-  auto variable = deps.variable.ptr; 
-  auto depType = deps.dependence_type;
-  if (depType == ompt_dependence_type_source || 
-      depType == ompt_dependence_type_sink) {
-    RAW_LOG(WARNING, "dependence type is %d", depType);   
+void TaskDepGraph::addDeps(const ompt_dependence_t* deps, int ndeps, 
+                           TaskData* taskData) {
+  auto curTaskId = taskData->expLocalId;   
+  auto parentId = taskData->parentLocalId;
+  std::vector<std::pair<int, int>> edges;
+  for (int i = 0; i < ndeps; ++i) {
+    // dependence variable is stored in ptr field
+    auto variable = deps[i].variable.ptr; 
+    auto depType = deps[i].dependence_type;
+    if (depType == ompt_dependence_type_source || 
+        depType == ompt_dependence_type_sink) {
+      RAW_LOG(WARNING, "dependence type is %d", depType);   
+      continue;
+    }
+    if (depType == ompt_dependence_type_mutexinoutset) {
+      taskData->isMutexTask = true;
+    }
+    RAW_DLOG(INFO, "variable: %lx exp id: %d", variable, curTaskId);
+    auto& shard = _shards[hashVariable(parentId, variable) >> 60 & 
+        (DEP_GRAPH_SHARDS - 1)];
+    McsNode node;
+    LockGuard guard(&(shard.lock), &node);
+    _advanceFrontier(_getFrontier(shard, parentId, variable), depType, 
+            curTaskId, edges);
+  }
+  if (edges.empty()) {
     return;
   }
-  if (depType == ompt_dependence_type_mutexinoutset) {
-    auto taskData = static_cast<TaskData*>(taskPtr);
-    taskData->isMutexTask = true;
+  McsNode node;
+  LockGuard guard(&_indexLock, &node);
+  auto version = _version.load(std::memory_order_relaxed);
+  _version.store(version + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (const auto& edge : edges) {
+    addEdge(edge.first, edge.second);
   }
-  // look up tasks that share the same dependence variable
-  if (_deps.find(variable) == _deps.end()) {
-    // no variable is found, it could be the first encountered task
-    std::vector<std::pair<void*, ompt_dependence_type_t>>  depVec;
-    depVec.push_back(std::make_pair(taskPtr, depType));
-    _deps[variable] = depVec;
-  } else {
-    // found the dependence variable, iterate over all pairs in the vector
-    auto curTaskData = static_cast<TaskData*>(taskPtr);
-    for (const auto& pair : _deps[variable]) {
-      auto otherTaskData = static_cast<TaskData*>(pair.first);
-      auto otherTaskId = otherTaskData->expLocalId;
-      RAW_DLOG(INFO, "variable: %lx task ptr: %lx exp id: %d", 
-		      variable, otherTaskData, otherTaskId);
-      auto curTaskId = curTaskData->expLocalId;   
-      if (curTaskId > otherTaskId) {
-        auto otherDepType = pair.second;          
-        switch(depType) {
-	  case ompt_dependence_type_in:
-            if (otherDepType == ompt_dependence_type_out || 
-                otherDepType == ompt_dependence_type_inout ||
-                otherDepType == ompt_dependence_type_mutexinoutset) {
-              addEdge((void*)otherTaskData, (void*)curTaskData);   
-	    }	    
-	    break;
-	  case ompt_dependence_type_out:
-	  case ompt_dependence_type_inout:
-	    addEdge((void*)otherTaskData, (void*)curTaskData); 
-	    break;
-	  case ompt_dependence_type_mutexinoutset:
-            if (otherDepType == ompt_dependence_type_in ||
-	        otherDepType == ompt_dependence_type_inout ||
-		otherDepType == ompt_dependence_type_out) {
-              addEdge((void*)otherTaskData, (void*)curTaskData);
-	    } 
-	    break;
-	  default:
-	    break;
-	}
+  _version.store(version + 2, std::memory_order_release);
+}
+
+/*
+ * Collect in `edges` the edges from the frontier of a variable to the 
+ * current task, then advance the frontier. Only edges from tasks generated
+ * before the current task are collected. Depending on the dependence type:
+ *  a. 'in': add an edge from the last 'out', 'inout' task or from each 
+ *      task of the last 'mutexinoutset' group to current task
+ *  b. 'out' and 'inout': add an edge from each 'in' task since, and from 
+ *      the last 'out', 'inout' task or 'mutexinoutset' group to current task
+ *  c.  'mutexinoutset': same as b, except that tasks of consecutive 
+ *       'mutexinoutset' dependences form a group of mutual exclusion tasks
+ *       that all depend on the tasks before the group.
+ * Edges to earlier tasks reach the rest of the tasks on the variable.
+ */
+void TaskDepGraph::_advanceFrontier(DepFrontier& frontier, 
+                                    ompt_dependence_type_t depType, 
+                                    int curTaskId,
+                                    std::vector<std::pair<int, int>>& edges) {
+  auto addEdges = [&](const std::vector<int>& froms) {
+    for (const auto from : froms) {
+      if (curTaskId > from) {
+        edges.push_back(std::make_pair(from, curTaskId));
       }
     }
-  } 
+  };
+  switch(depType) {
+    case ompt_dependence_type_in:
+      addEdges(frontier.writers);
+      frontier.readers.push_back(curTaskId);
+      break;
+    case ompt_dependence_type_out:
+    case ompt_dependence_type_inout:
+      addEdges(frontier.readers);
+      addEdges(frontier.writers);
+      frontier.writers.assign(1, curTaskId);
+      frontier.readers.clear();
+      frontier.groupPreds.clear();
+      frontier.isMutexGroup = false;
+      break;
+    case ompt_dependence_type_mutexinoutset:
+      if (!frontier.isMutexGroup || !frontier.readers.empty()) {
+        // start a new group after the current frontier
+        frontier.groupPreds = std::move(frontier.readers);
+        frontier.groupPreds.insert(frontier.groupPreds.end(), 
+                frontier.writers.begin(), frontier.writers.end());
+        frontier.writers.clear();
+        frontier.readers.clear();
+        frontier.isMutexGroup = true;
+      }
+      addEdges(frontier.groupPreds);
+      frontier.writers.push_back(curTaskId);
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+ * Return the frontier of dependence variable `variable` among the children
+ * of task `parentId` in `shard`, insert an empty one if the pair is new. The
+ * map doubles when it is 3/4 full. The caller holds the lock of the shard.
+ */
+DepFrontier& TaskDepGraph::_getFrontier(DepShard& shard, int parentId, 
+                                        void* variable) {
+  auto& slots = shard.slots;
+  auto mask = slots.size() - 1;
+  auto index = (hashVariable(parentId, variable) >> 32) & mask;
+  while (slots[index].variable != nullptr) {
+    if (slots[index].variable == variable && 
+        slots[index].parentId == parentId) {
+      return slots[index].frontier;
+    }
+    index = (index + 1) & mask;
+  }
+  if ((shard.numVariables + 1) * 4 > slots.size() * 3) {
+    std::vector<DepSlot> oldSlots(slots.size() * 2);
+    oldSlots.swap(slots);
+    mask = slots.size() - 1;
+    for (auto& slot : oldSlots) {
+      if (slot.variable == nullptr) {
+        continue;
+      }
+      auto newIndex = (hashVariable(slot.parentId, slot.variable) >> 32) & 
+          mask;
+      while (slots[newIndex].variable != nullptr) {
+        newIndex = (newIndex + 1) & mask;
+      }
+      slots[newIndex] = std::move(slot);
+    }
+    return _getFrontier(shard, parentId, variable);
+  }
+  slots[index].variable = variable;
+  slots[index].parentId = parentId;
+  shard.numVariables++;
+  return slots[index].frontier;
+}
+
+/*
+ * Find the chunk of node `id` and the offset of the node in the chunk.
+ */
+static void locateNode(int id, int& chunkIndex, uint64_t& offset) {
+  auto index = static_cast<uint64_t>(id) + (1UL << DEP_NODE_CHUNK_BITS);
+  auto bit = 63 - __builtin_clzl(index);
+  chunkIndex = bit - DEP_NODE_CHUNK_BITS;
+  offset = index - (1UL << bit);
+}
+
+static uint64_t getChunkSize(int chunkIndex) {
+  return 1UL << (DEP_NODE_CHUNK_BITS + chunkIndex);
+}
+
+static void freeAncestorList(AncestorList* list) {
+  if (list) {
+    delete[] list->entries;
+    delete list;
+  }
+}
+
+TaskDepGraph::TaskDepGraph(): _version(0) {
+  mcsInit(&_indexLock);
+  for (auto& chunk : _nodeChunks) {
+    chunk.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+TaskDepGraph::~TaskDepGraph() {
+  for (int i = 0; i < DEP_NODE_NUM_CHUNKS; ++i) {
+    auto chunk = _nodeChunks[i].load(std::memory_order_relaxed);
+    if (!chunk) {
+      continue;
+    }
+    for (uint64_t j = 0; j < getChunkSize(i); ++j) {
+      freeAncestorList(chunk[j].ancestors);
+    }
+    delete[] chunk;
+  }
+  for (const auto list : _retiredLists) {
+    freeAncestorList(list);
+  }
+}
+
+/*
+ * Return node `id`, nullptr if its chunk does not exist. Safe without the
+ * index lock.
+ */
+DepNode* TaskDepGraph::_findNode(int id) {
+  if (id < 0) {
+    return nullptr;
+  }
+  int chunkIndex;
+  uint64_t offset;
+  locateNode(id, chunkIndex, offset);
+  auto chunk = _nodeChunks[chunkIndex].load(std::memory_order_acquire);
+  return chunk ? &chunk[offset] : nullptr;
+}
+
+/*
+ * Return node `id`, allocate its chunk if it does not exist. The caller 
+ * holds the index lock.
+ */
+DepNode& TaskDepGraph::_getNode(int id) {
+  int chunkIndex;
+  uint64_t offset;
+  locateNode(id, chunkIndex, offset);
+  auto chunk = _nodeChunks[chunkIndex].load(std::memory_order_relaxed);
+  if (!chunk) {
+    chunk = new DepNode[getChunkSize(chunkIndex)];
+    _nodeChunks[chunkIndex].store(chunk, std::memory_order_release);
+  }
+  return chunk[offset];
+}
+
+/*
+ * Put node `node` with id `id` at the start of a new chain.
+ */
+void TaskDepGraph::_assignChain(DepNode& node, int id) {
+  __atomic_store_n(&node.position, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&node.chain, static_cast<int>(_chainTails.size()), 
+          __ATOMIC_RELAXED);
+  _chainTails.push_back(id);
+}
+
+/*
+ * Return a copy of the ancestors of `node`. The caller holds the index lock.
+ */
+static std::vector<std::pair<int, int>> getAncestors(const DepNode& node) {
+  auto list = node.ancestors;
+  if (!list) {
+    return {};
+  }
+  return std::vector<std::pair<int, int>>(list->entries, 
+          list->entries + list->size);
+}
+
+/*
+ * Return true if ancestors `list` hold a position on chain `chain` at or
+ * after `position`. The list may be updated concurrently, the caller 
+ * validates the result.
+ */
+static bool ancestorsReach(const AncestorList* list, int chain, 
+                           int position) {
+  if (!list) {
+    return false;
+  }
+  auto size = std::min(__atomic_load_n(&list->size, __ATOMIC_RELAXED), 
+          list->capacity);
+  int low = 0;
+  int high = size;
+  while (low < high) {
+    auto mid = (low + high) / 2;
+    if (__atomic_load_n(&list->entries[mid].first, __ATOMIC_RELAXED) < 
+            chain) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low < size && 
+      __atomic_load_n(&list->entries[low].first, __ATOMIC_RELAXED) == 
+          chain &&
+      __atomic_load_n(&list->entries[low].second, __ATOMIC_RELAXED) >= 
+          position;
 }
 
-void TaskDepGraph::addEdge(void* from, void* to) {
-  if (_graph.find(from) == _graph.end()) {
-    std::vector<void*> nodes;
-    nodes.push_back(to);
-    _graph[from] = nodes;
+/*
+ * Return the ancestors of node `node` that its successors inherit, i.e., 
+ * its own ancestors and itself.
+ */
+static std::vector<std::pair<int, int>> getInherited(const DepNode& node) {
+  auto inherited = getAncestors(node);
+  auto it = std::lower_bound(inherited.begin(), inherited.end(), 
+          std::make_pair(node.chain, 0));
+  if (it != inherited.end() && it->first == node.chain) {
+    it->second = std::max(it->second, node.position);
   } else {
-    _graph[from].push_back(to);
+    inherited.insert(it, std::make_pair(node.chain, node.position));
   }
+  return inherited;
 }
 
 /*
- * Use dfs to find directed path. We assume the graph is DAG.
+ * Replace the ancestors of `node` with `ancestors`. The list is overwritten
+ * in place if it has room, otherwise a list of twice the capacity is 
+ * published and the old one is retired. The caller holds the index lock.
  */
-bool TaskDepGraph::hasPath(void* from, void* to) {
-  std::unordered_map<void*, bool> visited;  
-  if (_graph.find(from) == _graph.end()) {
-    return false;	
+void TaskDepGraph::_setAncestors(DepNode& node, 
+        const std::vector<std::pair<int, int>>& ancestors) {
+  auto list = node.ancestors;
+  auto size = static_cast<int>(ancestors.size());
+  if (!list || list->capacity < size) {
+    auto capacity = list ? list->capacity * 2 : 2;
+    while (capacity < size) {
+      capacity *= 2;
+    }
+    auto newList = new AncestorList{capacity, size, 
+        new std::pair<int, int>[capacity]};
+    std::copy(ancestors.begin(), ancestors.end(), newList->entries);
+    if (list) {
+      _retiredLists.push_back(list);
+    }
+    __atomic_store_n(&node.ancestors, newList, __ATOMIC_RELEASE);
+    return;
+  }
+  for (int i = 0; i < size; ++i) {
+    __atomic_store_n(&list->entries[i].first, ancestors[i].first, 
+            __ATOMIC_RELAXED);
+    __atomic_store_n(&list->entries[i].second, ancestors[i].second, 
+            __ATOMIC_RELAXED);
   }
-  std::stack<void*> todo;
-  todo.push(from);
+  __atomic_store_n(&list->size, size, __ATOMIC_RELAXED);
+}
+
+/*
+ * Merge chain positions `more` into the ancestors of node `id`. If the
+ * ancestors grow, the successors of the node inherit them as well.
+ */
+void TaskDepGraph::_mergeAncestors(int id, 
+        const std::vector<std::pair<int, int>>& more) {
+  std::stack<std::pair<int, std::vector<std::pair<int, int>>>> todo;
+  todo.push(std::make_pair(id, more));
   while (!todo.empty()) {
-    auto cur = todo.top();
-    todo.pop(); 
-    if (cur == to) {
-      return true;
+    auto cur = todo.top().first;
+    auto entries = std::move(todo.top().second);
+    todo.pop();
+    auto& node = _getNode(cur);
+    auto ancestors = getAncestors(node);
+    std::vector<std::pair<int, int>> merged;
+    merged.reserve(ancestors.size() + entries.size());
+    auto changed = false;
+    size_t i = 0, j = 0;
+    while (i < ancestors.size() || j < entries.size()) {
+      if (j == entries.size() || (i < ancestors.size() && 
+          ancestors[i].first < entries[j].first)) {
+        merged.push_back(ancestors[i++]);
+      } else if (i == ancestors.size() || 
+          entries[j].first < ancestors[i].first) {
+        merged.push_back(entries[j++]);
+        changed = true;
+      } else {
+        if (entries[j].second > ancestors[i].second) {
+          merged.push_back(entries[j]);
+          changed = true;
+        } else {
+          merged.push_back(ancestors[i]);
+        }
+        i++;
+        j++;
+      }
     }
-    if (visited.find(cur) != visited.end()) {
-      continue; 
+    if (!changed) {
+      continue;
     }
-    visited[cur] = true;
-    for (const auto neighbor : _graph[cur]) {
-      if (visited.find(neighbor) == visited.end()) {
-        todo.push(neighbor);
-      }
+    _setAncestors(node, merged);
+    for (const auto successor : node.successors) {
+      todo.push(std::make_pair(successor, getInherited(node)));
     }
   }
-  return false;
+}
+
+/*
+ * Add edge from node `from` to node `to`. Node `to` continues the chain of
+ * `from` if `from` is its tail, and inherits the ancestors of `from`. An 
+ * edge implied by the known ancestors of `to` is not stored. The caller 
+ * holds the index lock and has made the version odd.
+ */
+void TaskDepGraph::addEdge(int from, int to) {
+  auto& fromNode = _getNode(from);
+  auto& toNode = _getNode(to);
+  if (fromNode.chain < 0) {
+    _assignChain(fromNode, from);
+  }
+  if (ancestorsReach(toNode.ancestors, fromNode.chain, fromNode.position) ||
+      (toNode.chain == fromNode.chain && 
+       toNode.position > fromNode.position)) {
+    return;
+  }
+  if (toNode.chain < 0 && _chainTails[fromNode.chain] == from) {
+    __atomic_store_n(&toNode.position, fromNode.position + 1, 
+            __ATOMIC_RELAXED);
+    __atomic_store_n(&toNode.chain, fromNode.chain, __ATOMIC_RELAXED);
+    _chainTails[fromNode.chain] = to;
+  }
+  fromNode.successors.push_back(to);
+  _mergeAncestors(to, getInherited(fromNode));
+}
+
+/*
+ * Return true if there is a directed path from node `from` to node `to`.
+ * The index is read optimistically and the result is only returned if no
+ * writer updated the index meanwhile. After DEP_INDEX_READ_RETRIES failed
+ * attempts the query waits for the writers on the index lock.
+ */
+bool TaskDepGraph::hasPath(int from, int to) {
+  for (int i = 0; i < DEP_INDEX_READ_RETRIES; ++i) {
+    auto version = _version.load(std::memory_order_acquire);
+    if (version & 1) {
+      continue;
+    }
+    auto result = _hasPath(from, to);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (_version.load(std::memory_order_relaxed) == version) {
+      return result;
+    }
+  }
+  McsNode node;
+  LockGuard guard(&_indexLock, &node);
+  return _hasPath(from, to);
+}
+
+/*
+ * A path exists if `to` is on the chain of `from` at a later position, or a
+ * node of that chain at or after `from` reaches `to`. Fields of the nodes 
+ * are loaded atomically, the caller either holds the index lock or 
+ * validates the result against the version.
+ */
+bool TaskDepGraph::_hasPath(int from, int to) {
+  auto fromNode = _findNode(from);
+  auto toNode = _findNode(to);
+  if (!fromNode || !toNode) {
+    return false;
+  }
+  auto fromChain = __atomic_load_n(&fromNode->chain, __ATOMIC_RELAXED);
+  auto fromPosition = __atomic_load_n(&fromNode->position, __ATOMIC_RELAXED);
+  if (fromChain < 0) {
+    // a node without chain has no outgoing edge
+    return false;
+  }
+  if (__atomic_load_n(&toNode->chain, __ATOMIC_RELAXED) == fromChain) {
+    return __atomic_load_n(&toNode->position, __ATOMIC_RELAXED) >= 
+        fromPosition;
+  }
+  return ancestorsReach(__atomic_load_n(&toNode->ancestors, 
+              __ATOMIC_ACQUIRE), fromChain, fromPosition);
 }
 
 }
@@ -0,0 +1,66 @@
+/*
+ * Contention benchmark for the mcs lock of RompLib. Threads repeatedly take
+ * one lock and update a shared counter, with 1x, 2x and 4x as many threads
+ * as cores, once with spinning waiters and once with waiters parking on a
+ * futex. Build it from the repository root with:
+ *   g++ -std=c++17 -O2 -pthread -IRompLib/include tests/bench_mcs_contention.cpp
+ *       RompLib/src/McsLock.cpp -o bench_mcs_contention
+ *   ./bench_mcs_contention [acquisitions per thread]
+ */
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "McsLock.h"
+
+using namespace std;
+
+static McsLock lock;
+static volatile uint64_t counter;
+
+static double runContention(int numThreads, int numIterations) {
+  mcsInit(&lock);
+  counter = 0;
+  auto start = chrono::steady_clock::now();
+  vector<thread> threads;
+  for (int i = 0; i < numThreads; ++i) {
+    threads.emplace_back([numIterations]() {
+      for (int k = 0; k < numIterations; ++k) {
+        McsNode node;
+        LockGuard guard(&lock, &node);
+        // a short critical section like a shadow slot update
+        for (int j = 0; j < 16; ++j) {
+          counter = counter + 1;
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  if (counter != static_cast<uint64_t>(numThreads) * numIterations * 16) {
+    cerr << "mutual exclusion violated" << endl;
+    exit(1);
+  }
+  return elapsed.count();
+}
+
+int main(int argc, const char* argv[]) {
+  int numIterations = argc > 1 ? atoi(argv[1]) : 20000;
+  int numCores = thread::hardware_concurrency();
+  for (int factor = 1; factor <= 4; factor *= 2) {
+    auto numThreads = numCores * factor;
+    for (auto parking : {false, true}) {
+      mcsSetParking(parking);
+      auto elapsed = runContention(numThreads, numIterations);
+      cout << "oversubscription: " << factor << "x threads: " << numThreads
+           << (parking ? " park" : " spin") << " time: " << elapsed << " s"
+           << " acquisitions/s: " << numThreads * numIterations / elapsed
+           << endl;
+    }
+  }
+  return 0;
+}
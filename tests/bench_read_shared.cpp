@@ -0,0 +1,44 @@
+/*
+ * Benchmark for locations read by all threads of a team. In every phase all
+ * threads read the whole shared array, then after a barrier one thread
+ * writes it. Without read summarization the access history of each element
+ * grows with the number of threads, and so does the cost of every write.
+ * The benchmark sweeps the team size from 1 to the given maximum in powers
+ * of two. Build and instrument it like `test_lib_inst.cpp`, then run:
+ *   ./bench_read_shared.inst [max threads] [phases]
+ */
+#include <iostream>
+#include <omp.h>
+#include <stdlib.h>
+#include <vector>
+using namespace std;
+
+#define ARRAY_SIZE 4096
+
+int main(int argc, const char* argv[]) {
+  int maxThreads = argc > 1 ? atoi(argv[1]) : 64;
+  int numPhases = argc > 2 ? atoi(argv[2]) : 8;
+  vector<double> shared(ARRAY_SIZE, 1.0);
+  for (int numThreads = 1; numThreads <= maxThreads; numThreads *= 2) {
+    double sum = 0;
+    auto start = omp_get_wtime();
+    #pragma omp parallel num_threads(numThreads) reduction(+:sum)
+    {
+      for (int phase = 0; phase < numPhases; ++phase) {
+        for (int i = 0; i < ARRAY_SIZE; ++i) {
+          sum += shared[i];
+        }
+        #pragma omp barrier
+        #pragma omp master
+        for (int i = 0; i < ARRAY_SIZE; ++i) {
+          shared[i] += 1.0;
+        }
+        #pragma omp barrier
+      }
+    }
+    auto elapsed = omp_get_wtime() - start;
+    cout << "threads: " << numThreads << " time: " << elapsed << " s"
+         << " checksum: " << sum << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Stress benchmark for the task dependence graph of RompLib. Producer
+ * threads register tasks with dependences concurrently, as threads of a
+ * team creating dependent tasks do: each producer runs a pipeline of inout
+ * tasks over its own variables, and every few tasks reads a variable shared
+ * by all producers. Each producer also queries the graph for paths between
+ * its tasks. The benchmark runs once with every registration behind one
+ * lock, as the parallel region lock did, and once with the sharded graph.
+ * With the prefixes exported as in README.md, build it from the repository
+ * root with:
+ *   g++ -std=c++17 -O2 -pthread -IRompLib/include -I$LLVM_PREFIX/include
+ *       -I$GLOG_PREFIX/include -I$GFLAGS_PREFIX/include
+ *       tests/bench_task_deps.cpp RompLib/src/TaskDepGraph.cpp
+ *       RompLib/src/McsLock.cpp -L$GLOG_PREFIX/lib -lglog -o bench_task_deps
+ *   ./bench_task_deps [producers] [tasks per producer]
+ * ompt.h comes from llvm-openmp, glog is linked for the warnings logged by
+ * TaskDepGraph.cpp.
+ */
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "McsLock.h"
+#include "TaskData.h"
+#include "TaskDepGraph.h"
+
+using namespace romp;
+using namespace std;
+
+#define VARS_PER_PRODUCER 8
+#define SHARED_READ_PERIOD 16
+
+static McsLock regionLock;
+static int sharedVariables[VARS_PER_PRODUCER];
+
+static double runProducers(int numProducers, int numTasks, bool serialize,
+                           uint64_t& numPaths) {
+  TaskDepGraph graph;
+  atomic<int> nextTaskId(0);
+  atomic<uint64_t> paths(0);
+  vector<vector<int>> variables(numProducers,
+          vector<int>(VARS_PER_PRODUCER));
+  auto start = chrono::steady_clock::now();
+  vector<thread> threads;
+  for (int p = 0; p < numProducers; ++p) {
+    threads.emplace_back([&, p]() {
+      vector<int> taskIds;
+      uint64_t localPaths = 0;
+      for (int k = 0; k < numTasks; ++k) {
+        TaskData taskData;
+        taskData.expLocalId = nextTaskId.fetch_add(1);
+        // every producer stands for another implicit task of the team
+        taskData.parentLocalId = -1 - p;
+        ompt_dependence_t deps[2];
+        deps[0].variable.ptr = &variables[p][k % VARS_PER_PRODUCER];
+        deps[0].dependence_type = ompt_dependence_type_inout;
+        auto ndeps = 1;
+        if (k % SHARED_READ_PERIOD == 0) {
+          deps[1].variable.ptr = &sharedVariables[k % VARS_PER_PRODUCER];
+          deps[1].dependence_type = ompt_dependence_type_in;
+          ndeps = 2;
+        }
+        if (serialize) {
+          McsNode node;
+          LockGuard guard(&regionLock, &node);
+          graph.addDeps(deps, ndeps, &taskData);
+        } else {
+          graph.addDeps(deps, ndeps, &taskData);
+        }
+        taskIds.push_back(taskData.expLocalId);
+        // an earlier task of the same pipeline, and an unrelated one
+        auto from = taskIds[k / 2];
+        localPaths += graph.hasPath(from, taskData.expLocalId);
+        localPaths += graph.hasPath(taskIds[k / 3], taskIds[k / 2]);
+      }
+      paths.fetch_add(localPaths);
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  numPaths = paths.load();
+  return elapsed.count();
+}
+
+int main(int argc, const char* argv[]) {
+  int numCores = thread::hardware_concurrency();
+  int numProducers = argc > 1 ? atoi(argv[1]) : numCores * 2;
+  int numTasks = argc > 2 ? atoi(argv[2]) : 20000;
+  mcsInit(&regionLock);
+  // producers may outnumber cores, let waiters park instead of spinning
+  mcsSetParking(true);
+  for (auto serialize : {true, false}) {
+    uint64_t numPaths = 0;
+    auto elapsed = runProducers(numProducers, numTasks, serialize, numPaths);
+    cout << "producers: " << numProducers
+         << (serialize ? " region lock" : " sharded")
+         << " time: " << elapsed << " s"
+         << " tasks/s: " << numProducers * numTasks / elapsed
+         << " paths found: " << numPaths << endl;
+  }
+  return 0;
+}
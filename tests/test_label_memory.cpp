@@ -0,0 +1,117 @@
+/*
+ * Checks that the memory RompLib uses for task labels stays bounded within a
+ * single parallel region. One thread creates a long stream of rounds, every
+ * round is a task creating a batch of child tasks, and each task runs
+ * with labels of its own. Label entries of completed tasks have to be 
+ * released once no access record refers to them, instead of piling up until
+ * the region ends. The peak resident set size after a few warm-up rounds is
+ * compared with the peak after many more rounds. Like test_race_verdicts.cpp,
+ * the program is linked against libomptrace and built from the repository
+ * root with:
+ *   g++ -std=c++17 -O0 -fopenmp -I$LLVM_PREFIX/include
+ *       tests/test_label_memory.cpp -L/path/to/romp-v2/install/lib
+ *       -lomptrace -L$LLVM_PREFIX/lib -lomp -o test_label_memory
+ *   ./test_label_memory
+ * The exit status is 0 if the growth stays within the bound.
+ */
+#include <iostream>
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+extern "C" void checkAccess(void* address, uint32_t bytesAccessed,
+                            void* instnAddr, bool hwLock, bool isWrite);
+
+#define NUM_THREADS 4
+#define TASKS_PER_ROUND 512
+#define NUM_WARMUP_ROUNDS 16
+#define NUM_ROUNDS 256
+#define MAX_GROWTH_KB (8 * 1024)
+
+static void __attribute__((noinline)) readInt(int* address) {
+  checkAccess(address, sizeof(int), __builtin_return_address(0), false,
+          false);
+}
+
+static void __attribute__((noinline)) writeInt(int* address) {
+  checkAccess(address, sizeof(int), __builtin_return_address(0), false,
+          true);
+}
+
+/*
+ * Return the peak resident set size of the process in KB, -1 if unknown.
+ */
+static long getPeakRss() {
+  auto file = fopen("/proc/self/status", "r");
+  if (!file) {
+    return -1;
+  }
+  char line[256];
+  long peakRss = -1;
+  while (fgets(line, sizeof(line), file)) {
+    if (strncmp(line, "VmHWM:", 6) == 0) {
+      sscanf(line + 6, "%ld", &peakRss);
+      break;
+    }
+  }
+  fclose(file);
+  return peakRss;
+}
+
+/*
+ * Create one round of tasks on variables private to the round. Every task
+ * accesses a variable of its own, so no data race is reported and every
+ * access goes through the access history. The parent reads all variables 
+ * after the taskwait. A task only counts a bounded number of children in its
+ * label, so each round is a task of its own.
+ */
+static void createRound() {
+  #pragma omp task
+  {
+    int variables[TASKS_PER_ROUND];
+    for (int i = 0; i < TASKS_PER_ROUND; ++i) {
+      auto variable = &variables[i];
+      #pragma omp task
+      {
+        writeInt(variable);
+        readInt(variable);
+      }
+    }
+    #pragma omp taskwait
+    for (int i = 0; i < TASKS_PER_ROUND; ++i) {
+      readInt(&variables[i]);
+    }
+  }
+}
+
+int main() {
+  long warmupPeakRss = -1;
+  long peakRss = -1;
+  #pragma omp parallel num_threads(NUM_THREADS)
+  #pragma omp single
+  {
+    for (int i = 0; i < NUM_WARMUP_ROUNDS; ++i) {
+      createRound();
+    }
+    #pragma omp taskwait
+    warmupPeakRss = getPeakRss();
+    for (int i = 0; i < NUM_ROUNDS; ++i) {
+      createRound();
+    }
+    #pragma omp taskwait
+    peakRss = getPeakRss();
+  }
+  if (warmupPeakRss < 0 || peakRss < 0) {
+    cerr << "cannot read peak rss" << endl;
+    return 1;
+  }
+  auto growth = peakRss - warmupPeakRss;
+  cout << (growth <= MAX_GROWTH_KB ? "PASS" : "FAIL")
+       << " peak rss after warm-up: " << warmupPeakRss << " KB, after "
+       << NUM_ROUNDS * TASKS_PER_ROUND << " more tasks: " << peakRss
+       << " KB" << endl;
+  return growth <= MAX_GROWTH_KB ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+/*
+ * Functional checks of the race verdicts of RompLib. Every case makes its
+ * memory accesses through `checkAccess` directly, so the program is linked
+ * against libomptrace instead of being instrumented. Each case runs in a
+ * child process and the verdict the tool logs at finalization is compared
+ * with the expected one. With the prefixes exported as in README.md, build
+ * it from the repository root with:
+ *   g++ -std=c++17 -O0 -fopenmp -I$LLVM_PREFIX/include
+ *       tests/test_race_verdicts.cpp -L/path/to/romp-v2/install/lib
+ *       -lomptrace -L$LLVM_PREFIX/lib -lomp -o test_race_verdicts
+ *   ./test_race_verdicts [case]
+ * Without a case, all cases are run and the exit status is the number of
+ * cases with an unexpected verdict.
+ */
+#include <atomic>
+#include <iostream>
+#include <omp.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+extern "C" void checkAccess(void* address, uint32_t bytesAccessed,
+                            void* instnAddr, bool hwLock, bool isWrite);
+
+#define NUM_THREADS 8
+#define NUM_PRODUCERS 4
+#define TASKS_PER_PRODUCER 64
+#define NUM_CONTENDERS 32
+
+static int x;
+static int variables[NUM_PRODUCERS];
+
+static void __attribute__((noinline)) readInt(int* address) {
+  checkAccess(address, sizeof(int), __builtin_return_address(0), false,
+          false);
+}
+
+static void __attribute__((noinline)) writeInt(int* address) {
+  checkAccess(address, sizeof(int), __builtin_return_address(0), false,
+          true);
+}
+
+/*
+ * The reads of the team are summarized into one record, a write in the same
+ * barrier epoch races with the summary.
+ */
+static void writeAfterReadSummary() {
+  #pragma omp parallel num_threads(NUM_THREADS)
+  {
+    readInt(&x);
+    if (omp_get_thread_num() == NUM_THREADS / 2) {
+      writeInt(&x);
+    }
+  }
+}
+
+/*
+ * A write after the barrier that ends the summarized reads.
+ */
+static void writeAfterBarrierReadSummary() {
+  #pragma omp parallel num_threads(NUM_THREADS)
+  {
+    readInt(&x);
+    #pragma omp barrier
+    if (omp_get_thread_num() == NUM_THREADS / 2) {
+      writeInt(&x);
+    }
+  }
+}
+
+/*
+ * Readers of the next barrier epoch join the summary left by the first one,
+ * a write after both epochs is ordered with all of them.
+ */
+static void readerJoinsSummary() {
+  #pragma omp parallel num_threads(NUM_THREADS)
+  {
+    readInt(&x);
+    #pragma omp barrier
+    readInt(&x);
+    #pragma omp barrier
+    if (omp_get_thread_num() == NUM_THREADS / 2) {
+      writeInt(&x);
+    }
+  }
+}
+
+/*
+ * Readers that join the summary race with a write of the same epoch.
+ */
+static void readerJoinsSummaryRace() {
+  #pragma omp parallel num_threads(NUM_THREADS)
+  {
+    readInt(&x);
+    #pragma omp barrier
+    readInt(&x);
+    if (omp_get_thread_num() == NUM_THREADS / 2) {
+      writeInt(&x);
+    }
+  }
+}
+
+/*
+ * A value written by one thread is read again by the team after every
+ * barrier, then written again after the join of the region.
+ */
+static void barrierSeparatedReread() {
+  #pragma omp parallel num_threads(NUM_THREADS)
+  {
+    if (omp_get_thread_num() == 0) {
+      writeInt(&x);
+    }
+    #pragma omp barrier
+    readInt(&x);
+    #pragma omp barrier
+    readInt(&x);
+  }
+  writeInt(&x);
+}
+
+/*
+ * More threads than cores contend on one critical section, so the locks of
+ * the tool are contended as well.
+ */
+static void contendedCritical() {
+  #pragma omp parallel num_threads(NUM_CONTENDERS)
+  {
+    for (int i = 0; i < 100; ++i) {
+      #pragma omp critical
+      {
+        readInt(&x);
+        writeInt(&x);
+      }
+    }
+  }
+}
+
+static void contendedCriticalRace() {
+  #pragma omp parallel num_threads(NUM_CONTENDERS)
+  {
+    for (int i = 0; i < 100; ++i) {
+      #pragma omp critical
+      {
+        readInt(&x);
+      }
+      writeInt(&x);
+    }
+  }
+}
+
+/*
+ * Every thread of the team registers a pipeline of dependent tasks on its
+ * own variable at the same time. Tasks of one pipeline are ordered by their
+ * dependences.
+ */
+static void concurrentDependRegistration() {
+  #pragma omp parallel num_threads(NUM_PRODUCERS)
+  {
+    auto variable = &variables[omp_get_thread_num()];
+    for (int i = 0; i < TASKS_PER_PRODUCER; ++i) {
+      #pragma omp task depend(inout: variable[0])
+      {
+        readInt(variable);
+        writeInt(variable);
+      }
+    }
+  }
+}
+
+/*
+ * Dependences only order sibling tasks. The tasks of different threads
+ * depend on the same variable, but are created by different implicit tasks.
+ */
+static void concurrentDependRegistrationRace() {
+  #pragma omp parallel num_threads(NUM_PRODUCERS)
+  {
+    for (int i = 0; i < TASKS_PER_PRODUCER; ++i) {
+      #pragma omp task depend(inout: x)
+      {
+        readInt(&x);
+        writeInt(&x);
+      }
+    }
+  }
+}
+
+/*
+ * Let the threads of the team create their tasks in turns, so that the 
+ * registrations of different threads interleave.
+ */
+static void waitForTurn(atomic<int>& turn, int myTurn) {
+  while (turn.load() != myTurn) {
+    sched_yield();
+  }
+}
+
+/*
+ * The pipelines of all threads depend on one shared variable, while each
+ * pipeline writes a variable of its own. Tasks of another thread registering
+ * in between must not break the order within a pipeline.
+ */
+static void sharedDependVariable() {
+  atomic<int> turn(0);
+  #pragma omp parallel num_threads(NUM_PRODUCERS)
+  {
+    auto threadNum = omp_get_thread_num();
+    auto variable = &variables[threadNum];
+    for (int i = 0; i < TASKS_PER_PRODUCER; ++i) {
+      waitForTurn(turn, i * NUM_PRODUCERS + threadNum);
+      #pragma omp task depend(inout: x)
+      {
+        readInt(variable);
+        writeInt(variable);
+      }
+      turn++;
+    }
+  }
+}
+
+/*
+ * Pipelines of different threads that depend on one shared variable are not
+ * ordered with each other, their writes to a common variable race.
+ */
+static void sharedDependVariableRace() {
+  atomic<int> turn(0);
+  #pragma omp parallel num_threads(NUM_PRODUCERS)
+  {
+    auto threadNum = omp_get_thread_num();
+    for (int i = 0; i < TASKS_PER_PRODUCER; ++i) {
+      waitForTurn(turn, i * NUM_PRODUCERS + threadNum);
+      #pragma omp task depend(inout: x)
+      {
+        writeInt(&variables[0]);
+      }
+      turn++;
+    }
+  }
+}
+
+typedef struct VerdictCase {
+  const char* name;
+  bool expectRace;
+  void (*run)();
+} VerdictCase;
+
+static const VerdictCase verdictCases[] = {
+  {"write_after_read_summary", true, writeAfterReadSummary},
+  {"write_after_barrier_read_summary", false, writeAfterBarrierReadSummary},
+  {"reader_joins_summary", false, readerJoinsSummary},
+  {"reader_joins_summary_race", true, readerJoinsSummaryRace},
+  {"barrier_separated_reread", false, barrierSeparatedReread},
+  {"contended_critical", false, contendedCritical},
+  {"contended_critical_race", true, contendedCriticalRace},
+  {"concurrent_depend_registration", false, concurrentDependRegistration},
+  {"concurrent_depend_registration_race", true,
+      concurrentDependRegistrationRace},
+  {"shared_depend_variable", false, sharedDependVariable},
+  {"shared_depend_variable_race", true, sharedDependVariableRace},
+};
+
+/*
+ * Run the case in a child process and return the verdict logged by the tool
+ * on stderr: 1 for a data race, 0 for none, -1 if there is no verdict.
+ */
+static int runCase(const char* program, const VerdictCase& verdictCase) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return -1;
+  }
+  auto pid = fork();
+  if (pid == 0) {
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execl(program, program, verdictCase.name, nullptr);
+    _exit(127);
+  }
+  close(fds[1]);
+  string output;
+  char buffer[4096];
+  ssize_t numBytes;
+  while ((numBytes = read(fds[0], buffer, sizeof(buffer))) > 0) {
+    output.append(buffer, numBytes);
+  }
+  close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return -1;
+  }
+  if (output.find("no data race found") != string::npos) {
+    return 0;
+  } else if (output.find("data race found") != string::npos) {
+    return 1;
+  }
+  return -1;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc > 1) {
+    for (const auto& verdictCase : verdictCases) {
+      if (strcmp(argv[1], verdictCase.name) == 0) {
+        verdictCase.run();
+        return 0;
+      }
+    }
+    cerr << "unknown case: " << argv[1] << endl;
+    return 1;
+  }
+  int numFailures = 0;
+  for (const auto& verdictCase : verdictCases) {
+    auto verdict = runCase("/proc/self/exe", verdictCase);
+    auto passed = verdict == static_cast<int>(verdictCase.expectRace);
+    cout << (passed ? "PASS " : "FAIL ") << verdictCase.name << ": "
+         << (verdict < 0 ? "no verdict" :
+                 (verdict ? "data race" : "no data race")) << endl;
+    numFailures += !passed;
+  }
+  return numFailures;
+}